@@ -3,13 +3,28 @@
 
   Unlike the single-pattern algorithms, this is not taken from prior art. This
   is coded directly from the algorithm pseudo-code in the Aho-Corasick paper.
+
+  Besides the machine from the paper ("aho_corasick"), there are variants of
+  it built from the same goto and failure functions, each its own engine.
+  The program built from this file runs the paper's machine; the variants are
+  run by name through the combined binary (engines.cpp).
 */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <numeric>
 #include <queue>
-#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "pool.hpp"
 #include "run.hpp"
 
 // Rather than implement a translation table for the four characters in the DNA
@@ -28,23 +43,69 @@ constexpr int FAIL = -1;
   characters. Use this array to shorten those loops.
 */
 constexpr int OFFSETS_COUNT = 4;
-static std::vector<int> ALPHA_OFFSETS = {65, 67, 71, 84};
+static const std::vector<int> ALPHA_OFFSETS = {65, 67, 71, 84};
+
+// The code of each character, for the forms of the machine that only have
+// transitions on the four bases: A, C, G and T are 0 to 3, and anything else
+// is NOT_BASE.
+constexpr std::uint8_t NOT_BASE = 4;
+
+static std::array<std::uint8_t, 256> make_base_codes() {
+  std::array<std::uint8_t, 256> codes;
+  codes.fill(NOT_BASE);
+  for (int i = 0; i < OFFSETS_COUNT; i++)
+    codes[ALPHA_OFFSETS[i]] = i;
+
+  return codes;
+}
+
+static const std::array<std::uint8_t, 256> BASE_CODES = make_base_codes();
+
+/*
+  The variants that work on the four bases alone cannot take patterns with
+  any other characters in them.
+*/
+void check_bases(std::vector<std::string_view> const &patterns_data,
+                 std::string const &name) {
+  for (auto const &pattern : patterns_data)
+    for (char c : pattern)
+      if (BASE_CODES[(unsigned char)c] == NOT_BASE) {
+        std::ostringstream error;
+        error << name << ": pattern \"" << pattern
+              << "\" has a character other than A, C, G and T";
+        throw std::runtime_error{error.str()};
+      }
+}
+
+/*
+  The output function, in compressed sparse row form: the patterns matched on
+  entering state s are patterns[offsets[s]] up to (but not including)
+  patterns[offsets[s + 1]]. Each state's list is contiguous, so the search
+  walks a plain array rather than a tree.
+*/
+struct OutputFunction {
+  std::vector<int> offsets;
+  std::vector<int> patterns;
+};
 
 /*
   Enter the given pattern into the given goto-function, creating new states as
-  needed. When done, add the index of the pattern into the partial output
-  function for the state of the last character.
+  needed. When done, add the index of the pattern to the list of those that
+  end at the state of the last character. These lists are chained through
+  `next_output` (indexed by pattern), with `first_output` holding the head of
+  the list for each state, or FAIL. `new_state` is the highest state number
+  used so far, and is updated as states are added.
 */
-void enter_pattern(std::string const &pat, int idx,
+void enter_pattern(std::string_view pat, int idx,
                    std::vector<std::vector<int>> &goto_fn,
-                   std::vector<std::set<int>> &output_fn) {
+                   std::vector<int> &first_output,
+                   std::vector<int> &next_output, int &new_state) {
   int len = pat.length();
   int j = 0, state = 0;
-  static int new_state = 0;
 
   // Find the first leaf corresponding to a character in `pat`. From there is
   // where a new state (if needed) will be added.
-  while (goto_fn[state][pat[j]] != FAIL) {
+  while (j < len && goto_fn[state][pat[j]] != FAIL) {
     state = goto_fn[state][pat[j]];
     j++;
   }
@@ -58,108 +119,559 @@ void enter_pattern(std::string const &pat, int idx,
     state = new_state;
   }
 
-  output_fn[state].insert(idx);
+  next_output[idx] = first_output[state];
+  first_output[state] = idx;
 }
 
+// The patterns are split by their first character into one partition for
+// each base and one for everything else. See build_goto().
+constexpr int PARTITIONS = OFFSETS_COUNT + 1;
+
 /*
-  Build the goto function and the (partial) output function.
+  Build the goto function and the lists of the patterns that end at each
+  state (see enter_pattern()). The return value is the number of states.
+
+  Two patterns with different first characters share no states but the
+  start state, so the patterns are split by first character and the
+  partitions are entered in parallel over the pool, each into a range of
+  states of its own. The ranges are sized for the most states a partition
+  could need, and closed up afterwards.
 */
-void build_goto(std::vector<std::string> const &pats, int num_pats,
-                std::vector<std::vector<int>> &goto_fn,
-                std::vector<std::set<int>> &output_fn) {
-  int max_states = 0;
+int build_goto(std::vector<std::string_view> const &pats, int num_pats,
+               WorkPool &pool, std::vector<std::vector<int>> &goto_fn,
+               std::vector<int> &first_output, std::vector<int> &next_output) {
+  // Split up the patterns. The most states a partition could need is the
+  // sum of the lengths of its patterns, and its range starts where the one
+  // before it ends.
+  std::vector<int> members[PARTITIONS];
+  int start[PARTITIONS + 1] = {1};
+  int used[PARTITIONS];
+  auto partition = [](char c) { return BASE_CODES[(unsigned char)c]; };
+  for (int i = 0; i < num_pats; i++) {
+    int part = pats[i].empty() ? NOT_BASE : partition(pats[i][0]);
+    members[part].push_back(i);
+    start[part + 1] += pats[i].length();
+  }
+  for (int part = 0; part < PARTITIONS; part++)
+    start[part + 1] += start[part];
 
-  // Calculate the maximum number of states as being the sum of the lengths of
-  // patterns. This is overkill, but a more "serious" implementation would
-  // have a more "serious" graph implementation for the goto function.
-  for (int i = 0; i < num_pats; i++)
-    max_states += pats[i].length();
+  // Allocate for the goto function and the output lists. The rows are
+  // filled in by the partitions that own them.
+  goto_fn.resize(start[PARTITIONS]);
+  goto_fn[0].assign(ASIZE, FAIL);
+  first_output.resize(start[PARTITIONS], FAIL);
+  next_output.resize(num_pats, FAIL);
 
-  // Allocate for the goto function
-  goto_fn.resize(max_states, std::vector<int>(ASIZE, FAIL));
+  // OK, now actually build the goto function and output lists. Each
+  // partition adds its patterns in turn. The only row they share is the
+  // start state's, and they each write to different entries of it.
+  pool.parallel_for(
+      PARTITIONS, 1, [&](int, std::size_t begin, std::size_t end) {
+        for (std::size_t part = begin; part < end; part++) {
+          for (int state = start[part]; state < start[part + 1]; state++)
+            goto_fn[state].assign(ASIZE, FAIL);
 
-  // Allocate for the output function
-  output_fn.resize(max_states, std::set<int>());
+          int new_state = start[part] - 1;
+          for (int idx : members[part])
+            enter_pattern(pats[idx], idx, goto_fn, first_output, next_output,
+                          new_state);
+          used[part] = new_state + 1 - start[part];
+        }
+      });
 
-  // OK, now actually build the goto function and output function.
+  // Move each partition's states down to close up the gaps, and renumber
+  // the transitions into them to match. The rows are swapped rather than
+  // copied; the ones left behind are all unused, and are then dropped.
+  int shift[PARTITIONS];
+  int states = 1;
+  for (int part = 0; part < PARTITIONS; part++) {
+    shift[part] = start[part] - states;
+    for (int state = start[part]; state < start[part] + used[part]; state++) {
+      std::swap(goto_fn[states], goto_fn[state]);
+      std::swap(first_output[states], first_output[state]);
+      states++;
+    }
+  }
+  goto_fn.resize(states);
+  first_output.resize(states);
 
-  // Add each pattern in turn:
-  for (int i = 0; i < num_pats; i++)
-    enter_pattern(pats[i], i, goto_fn, output_fn);
+  pool.parallel_for(
+      PARTITIONS, 1, [&](int, std::size_t begin, std::size_t end) {
+        for (std::size_t part = begin; part < end; part++)
+          for (int state = start[part] - shift[part];
+               state < start[part] - shift[part] + used[part]; state++)
+            for (int &next : goto_fn[state])
+              if (next != FAIL)
+                next -= shift[part];
+      });
+  for (int c = 0; c < ASIZE; c++)
+    if (goto_fn[0][c] != FAIL)
+      goto_fn[0][c] -= shift[partition(c)];
 
   // Set the unused transitions in state 0 to point back to state 0:
   for (int i = 0; i < OFFSETS_COUNT; i++)
     if (goto_fn[0][ALPHA_OFFSETS[i]] == FAIL)
       goto_fn[0][ALPHA_OFFSETS[i]] = 0;
+
+  return states;
 }
 
+// The number of states in a block of one level of build_failure().
+constexpr std::size_t FAILURE_BLOCK = 1024;
+
 /*
-  Build the failure function and complete the output function.
+  Build the failure function. The states other than 0 are also listed in
+  `order` in the order they were reached, breadth-first: a state's failure
+  state always comes before it, so this is the order for any later pass that
+  builds on the failure state's results.
+
+  This goes a level of the trie at a time. The failure states of a level
+  only depend on those of the levels above it, so the states of each level
+  are shared out over the pool. Each block of them lists its children, and
+  the lists are put together in order to make the next level.
 */
 std::vector<int> build_failure(std::vector<std::vector<int>> const &goto_fn,
-                               std::vector<std::set<int>> &output_fn) {
-  // Need a simple queue of state numbers.
-  std::queue<int> queue;
-
+                               WorkPool &pool, std::vector<int> &order) {
   // Allocate the failure function storage. This also needs to be as long as
   // goto_fn is, for safety. Initializing all of its slots to 0 will allow a
   // shortcut or two in the rest of the algorithm.
   std::vector<int> failure_fn;
   failure_fn.resize(goto_fn.size(), 0);
 
-  // The queue starts out empty. Set it to be all states reachable from state 0
-  // and set failure(state) for those states to be 0.
+  // The first level is all states reachable from state 0, and failure(state)
+  // for those states is 0.
+  std::vector<int> level;
   for (int i = 0; i < OFFSETS_COUNT; i++) {
     int state = goto_fn[0][ALPHA_OFFSETS[i]];
     if (state == 0)
       continue;
 
-    queue.push(state);
+    level.push_back(state);
   }
 
   // This uses some single-letter variable names that match the published
   // algorithm. Their mnemonic isn't clear, or else I'd use more meaningful
   // names.
+  while (!level.empty()) {
+    order.insert(order.end(), level.begin(), level.end());
+
+    std::vector<std::vector<int>> children((level.size() + FAILURE_BLOCK - 1) /
+                                           FAILURE_BLOCK);
+    pool.parallel_for(
+        level.size(), FAILURE_BLOCK,
+        [&](int, std::size_t begin, std::size_t end) {
+          std::vector<int> &next = children[begin / FAILURE_BLOCK];
+          for (std::size_t idx = begin; idx < end; idx++) {
+            int r = level[idx];
+            for (int i = 0; i < OFFSETS_COUNT; i++) {
+              int a = ALPHA_OFFSETS[i];
+              int s = goto_fn[r][a];
+              if (s == FAIL)
+                continue;
+
+              next.push_back(s);
+              int state = failure_fn[r];
+              while (goto_fn[state][a] == FAIL)
+                state = failure_fn[state];
+              failure_fn[s] = goto_fn[state][a];
+            }
+          }
+        });
+
+    level.clear();
+    for (auto const &next : children)
+      level.insert(level.end(), next.begin(), next.end());
+  }
+
+  return failure_fn;
+}
+
+/*
+  The goto function, the lists of the patterns that end at each state, and
+  the failure function, which the machines that use the goto table are all
+  made from. Building one uses nothing from outside of it, so any number can
+  be built at once on different threads; and with a pool of more than one
+  thread, each is built using all of them.
+*/
+struct AhoCorasickBuilder {
+  // The members are built in the order they are declared in.
+  AhoCorasickBuilder(std::vector<std::string_view> const &patterns,
+                     WorkPool &pool)
+      : states{build_goto(patterns, patterns.size(), pool, goto_fn,
+                          first_output, next_output)},
+        failure_fn{build_failure(goto_fn, pool, order)} {}
+
+  std::vector<std::vector<int>> goto_fn;
+  std::vector<int> first_output, next_output, order;
+  int states;
+  std::vector<int> failure_fn;
+};
+
+/*
+  Complete the output function: each state matches the patterns that end
+  there, plus everything its failure state matches. Going breadth-first, the
+  failure state's list is already in place, and is copied in after the
+  state's own patterns.
+*/
+OutputFunction build_outputs(int states, std::vector<int> const &first_output,
+                             std::vector<int> const &next_output,
+                             std::vector<int> const &failure_fn,
+                             std::vector<int> const &order) {
+  OutputFunction outputs;
+  std::vector<int> counts(states, 0);
+  auto count_own = [&](int state) {
+    int count = 0;
+    for (int idx = first_output[state]; idx != FAIL; idx = next_output[idx])
+      count++;
+    return count;
+  };
+
+  counts[0] = count_own(0);
+  for (int state : order)
+    counts[state] = count_own(state) + counts[failure_fn[state]];
+
+  outputs.offsets.resize(states + 1, 0);
+  for (int state = 0; state < states; state++)
+    outputs.offsets[state + 1] = outputs.offsets[state] + counts[state];
+  outputs.patterns.resize(outputs.offsets[states]);
+
+  auto fill = [&](int state, int inherited) {
+    int at = outputs.offsets[state];
+    for (int idx = first_output[state]; idx != FAIL; idx = next_output[idx])
+      outputs.patterns[at++] = idx;
+    if (inherited != FAIL)
+      for (int k = outputs.offsets[inherited];
+           k < outputs.offsets[inherited + 1]; k++)
+        outputs.patterns[at++] = outputs.patterns[k];
+  };
+  fill(0, FAIL);
+  for (int state : order)
+    fill(state, failure_fn[state]);
+
+  return outputs;
+}
+
+OutputFunction build_outputs(AhoCorasickBuilder const &machine) {
+  return build_outputs(machine.states, machine.first_output,
+                       machine.next_output, machine.failure_fn, machine.order);
+}
+
+/*
+  The double-array form of the goto function, for dictionaries too big for
+  the table of ASIZE entries per state. Each state is a cell of the array,
+  with two fields: the children of state s are the cells base[s] + code, for
+  the code of each base (see BASE_CODES) it has a transition on, and each
+  cell's check is the state it is a child of. So the goto function from s on
+  code is base[s] + code, if that cell's check is s, and fails otherwise.
+  This takes two ints per state, and the cells left unused between states
+  are few.
+
+  The trie is built straight into the array, without the table: the patterns
+  are sorted, so those that go through any one state are a contiguous run of
+  them, and splitting that run on the next character gives the children.
+  This goes breadth-first, and each state's children are put in the first
+  free cells they fit into, so the states are numbered in much the same
+  order as they are reached; the ones nearest the start state, which are
+  used most, are kept close together.
+*/
+struct DoubleArrayCell {
+  int base;
+  int check;
+};
+
+// How many free cells to try a state's children at, before giving up and
+// putting them at the end of the array.
+constexpr int PLACEMENT_TRIES = 32;
+
+/*
+  Build the double array for the patterns, with the lists of the patterns
+  that end at each state (as build_goto() does) and the breadth-first order
+  of the states other than 0 (as build_failure() does). The patterns must be
+  made of the bases alone.
+*/
+std::vector<DoubleArrayCell>
+build_double_array(std::vector<std::string_view> const &pats,
+                   std::vector<int> &first_output,
+                   std::vector<int> &next_output, std::vector<int> &order) {
+  int num_pats = pats.size();
+  std::vector<int> sorted(num_pats);
+  std::iota(sorted.begin(), sorted.end(), 0);
+  std::sort(sorted.begin(), sorted.end(),
+            [&](int a, int b) { return pats[a] < pats[b]; });
+
+  // The trie is built a level at a time, and each level goes through the
+  // patterns in sorted order, so they are copied out in that order.
+  std::string text;
+  for (int idx : sorted)
+    text += pats[idx];
+  std::vector<std::string_view> sorted_pats;
+  for (std::size_t at = 0; int idx : sorted) {
+    sorted_pats.push_back(std::string_view{text}.substr(at, pats[idx].size()));
+    at += pats[idx].size();
+  }
+
+  // The end of the run of sorted patterns from `begin` (up to `end`) for
+  // which `in_run` holds, where those it holds for come first.
+  auto run_end = [&](int begin, int end, auto in_run) {
+    return std::partition_point(sorted_pats.begin() + begin,
+                                sorted_pats.begin() + end, in_run) -
+           sorted_pats.begin();
+  };
+
+  // A state in the trie still to be placed, with the run of sorted patterns
+  // that go through it.
+  struct Node {
+    int state;
+    std::size_t depth;
+    int begin, end;
+  };
+  std::queue<Node> queue;
+  queue.push({0, 0, 0, num_pats});
+
+  // The start state is cell 0, and is its own check so that the cell is not
+  // taken for anything else.
+  std::vector<DoubleArrayCell> cells{{1, 0}};
+  first_output.assign(1, FAIL);
+  next_output.assign(num_pats, FAIL);
+
+  // The free cells are kept in a list, in order, so that looking for room
+  // does not have to step over all the cells in use.
+  std::vector<int> next_free{FAIL}, prev_free{FAIL};
+  int first_free = FAIL, last_free = FAIL;
+  auto grow = [&](std::size_t size) {
+    for (int cell = cells.size(); cell < (int)size; cell++) {
+      cells.push_back({0, FAIL});
+      next_free.push_back(FAIL);
+      prev_free.push_back(last_free);
+      if (last_free == FAIL)
+        first_free = cell;
+      else
+        next_free[last_free] = cell;
+      last_free = cell;
+    }
+    first_output.resize(cells.size(), FAIL);
+  };
+  auto take = [&](int cell) {
+    if (prev_free[cell] == FAIL)
+      first_free = next_free[cell];
+    else
+      next_free[prev_free[cell]] = next_free[cell];
+    if (next_free[cell] == FAIL)
+      last_free = prev_free[cell];
+    else
+      prev_free[next_free[cell]] = prev_free[cell];
+  };
+
   while (!queue.empty()) {
-    int r = queue.front();
+    Node node = queue.front();
     queue.pop();
-    for (int i = 0; i < OFFSETS_COUNT; i++) {
-      int a = ALPHA_OFFSETS[i];
-      int s = goto_fn[r][a];
-      if (s == FAIL)
+    if (node.state != 0)
+      order.push_back(node.state);
+
+    // The patterns that end here sort before those that go on.
+    int idx = run_end(node.begin, node.end, [&](std::string_view pattern) {
+      return pattern.length() == node.depth;
+    });
+    for (int at = node.begin; at < idx; at++) {
+      next_output[sorted[at]] = first_output[node.state];
+      first_output[node.state] = sorted[at];
+    }
+    if (idx == node.end)
+      continue;
+
+    // Split the rest into a run for each child. The characters at this
+    // depth are in order, so the end of each run is found by a binary
+    // search rather than by looking at every pattern in it.
+    int codes[OFFSETS_COUNT], starts[OFFSETS_COUNT + 1], children = 0;
+    while (idx < node.end) {
+      char c = sorted_pats[idx][node.depth];
+      codes[children] = BASE_CODES[(unsigned char)c];
+      starts[children++] = idx;
+      idx = run_end(idx, node.end, [&](std::string_view pattern) {
+        return pattern[node.depth] == c;
+      });
+    }
+    starts[children] = node.end;
+
+    // Find the first base at which every child lands on a free cell. The
+    // array is made longer when the free cells run out, or when the children
+    // have not fitted in the first few tried: the cells passed over are left
+    // for states with fewer children to fill.
+    auto is_free = [&](std::size_t cell) {
+      return cell >= cells.size() || cells[cell].check == FAIL;
+    };
+    int base, tries = 0;
+    for (int cell = first_free;; cell = next_free[cell]) {
+      if (cell != FAIL && ++tries > PLACEMENT_TRIES)
+        cell = FAIL;
+      if (cell == FAIL) {
+        cell = cells.size();
+        grow(cells.size() + OFFSETS_COUNT);
+      }
+      base = cell - codes[0];
+      if (base < 1)
         continue;
+      int child = 1;
+      while (child < children && is_free(base + codes[child]))
+        child++;
+      if (child == children)
+        break;
+    }
 
-      queue.push(s);
-      int state = failure_fn[r];
-      while (goto_fn[state][a] == FAIL)
-        state = failure_fn[state];
-      failure_fn[s] = goto_fn[state][a];
-      output_fn[s].insert(output_fn[failure_fn[s]].begin(),
-                          output_fn[failure_fn[s]].end());
+    cells[node.state].base = base;
+    grow(base + codes[children - 1] + 1);
+    for (int child = 0; child < children; child++) {
+      int state = base + codes[child];
+      take(state);
+      cells[state].check = node.state;
+      queue.push({state, node.depth + 1, starts[child], starts[child + 1]});
     }
   }
 
+  // Pad the end, so that base + code is always a cell of the array.
+  cells.resize(cells.size() + OFFSETS_COUNT, {0, FAIL});
+  first_output.resize(cells.size(), FAIL);
+
+  return cells;
+}
+
+/*
+  Build the failure function over the double array. Each state's parent is
+  its check, and its code the distance from the parent's base; going in
+  breadth-first order, the parent's failure state is always known first.
+*/
+std::vector<int>
+build_double_array_failure(std::vector<DoubleArrayCell> const &cells,
+                           std::vector<int> const &order) {
+  std::vector<int> failure_fn(cells.size(), 0);
+  auto goto_fn = [&](int state, int code) {
+    int cell = cells[state].base + code;
+    return cells[cell].check == state ? cell : FAIL;
+  };
+
+  for (int state : order) {
+    int parent = cells[state].check;
+    if (parent == 0)
+      continue;
+
+    int code = state - cells[parent].base;
+    int fail = failure_fn[parent];
+    while (fail != 0 && goto_fn(fail, code) == FAIL)
+      fail = failure_fn[fail];
+    int next = goto_fn(fail, code);
+    failure_fn[state] = next == FAIL ? 0 : next;
+  }
+
   return failure_fn;
 }
 
-std::vector<MultiPatternData>
-init_aho_corasick(std::vector<std::string> const &patterns_data) {
-  std::vector<MultiPatternData> return_val;
-  return_val.reserve(4);
+// The forms the goto function can take, chosen when the patterns are
+// pre-processed.
+enum class GotoBackend { Table, DoubleArray };
+
+/*
+  The pre-processed form of the patterns, as used by aho_corasick(). Only one
+  of goto_fn and double_array is filled in, as given by `backend`.
+*/
+struct AhoCorasickPatterns {
+  int pattern_count;
+  GotoBackend backend;
+  std::vector<std::vector<int>> goto_fn;
+  std::vector<DoubleArrayCell> double_array;
+  std::vector<int> failure_fn;
+  OutputFunction output_fn;
+  // The length of each pattern, to turn the end of a match into its start.
+  std::vector<int> lengths;
+};
+
+/*
+  Pre-process the patterns, with the goto function in the form given by
+  `backend`. The table form is built with the threads of `pool`, if there is
+  one.
+*/
+AhoCorasickPatterns
+init_aho_corasick(std::vector<std::string_view> const &patterns_data,
+                  GotoBackend backend = GotoBackend::Table,
+                  WorkPool *pool = nullptr) {
   int patterns_count = patterns_data.size();
+  std::vector<int> lengths;
+  for (auto const &pattern : patterns_data)
+    lengths.push_back(pattern.length());
 
   // Initialize the multi-pattern structure.
-  std::vector<std::vector<int>> goto_fn;
-  std::vector<std::set<int>> output_fn;
-  build_goto(patterns_data, patterns_count, goto_fn, output_fn);
-  std::vector<int> failure_fn = build_failure(goto_fn, output_fn);
+  if (backend == GotoBackend::DoubleArray) {
+    check_bases(patterns_data, "aho_corasick_double_array");
+    std::vector<int> first_output, next_output, order;
+    std::vector<DoubleArrayCell> double_array =
+        build_double_array(patterns_data, first_output, next_output, order);
+    std::vector<int> failure_fn =
+        build_double_array_failure(double_array, order);
+    OutputFunction output_fn =
+        build_outputs(double_array.size(), first_output, next_output,
+                      failure_fn, order);
+
+    return {patterns_count,      backend,   {}, std::move(double_array),
+            std::move(failure_fn), output_fn, lengths};
+  }
+
+  WorkPool serial{1};
+  AhoCorasickBuilder machine{patterns_data, pool ? *pool : serial};
+  OutputFunction output_fn = build_outputs(machine);
+
+  return {patterns_count, backend,   std::move(machine.goto_fn),
+          {},             std::move(machine.failure_fn), output_fn,
+          lengths};
+}
+
+/*
+  Take the transition on a base from `state` in the double array, following
+  the failure function until there is one. The start state has a transition
+  on every base (back to itself, where it has no child), so this always stops
+  there.
+*/
+inline int double_array_step(DoubleArrayCell const *cells,
+                             int const *failure_fn, int state,
+                             std::uint8_t code) {
+  for (;;) {
+    int next = cells[state].base + code;
+    if (cells[next].check == state)
+      return next;
+    if (state == 0)
+      return 0;
+    state = failure_fn[state];
+  }
+}
+
+/*
+  The search over the double array. Apart from how the goto function is
+  looked up, this is the same as the loop in aho_corasick(), except that a
+  character that is not one of the bases sends the machine back to the start
+  state, as there are no transitions on it.
+*/
+template <typename Report>
+void aho_corasick_double_array(AhoCorasickPatterns const &pat_data,
+                               std::string_view sequence, Report report) {
+  // Unpack pat_data
+  DoubleArrayCell const *cells = pat_data.double_array.data();
+  int const *failure_fn = pat_data.failure_fn.data();
+  int const *offsets = pat_data.output_fn.offsets.data();
+  int const *patterns = pat_data.output_fn.patterns.data();
+  auto const &lengths = pat_data.lengths;
 
-  return_val.push_back(patterns_count);
-  return_val.push_back(goto_fn);
-  return_val.push_back(failure_fn);
-  return_val.push_back(output_fn);
+  int state = 0;
+  int n = sequence.length();
 
-  return return_val;
+  for (int i = 0; i < n; i++) {
+    std::uint8_t code = BASE_CODES[(unsigned char)sequence[i]];
+    if (code == NOT_BASE) {
+      state = 0;
+      continue;
+    }
+
+    state = double_array_step(cells, failure_fn, state, code);
+    for (int k = offsets[state]; k < offsets[state + 1]; k++)
+      report(patterns[k], i + 1 - lengths[patterns[k]]);
+  }
 }
 
 /*
@@ -167,41 +679,708 @@ init_aho_corasick(std::vector<std::string> const &patterns_data) {
   passed in, as the machine of goto_fn/failure_fn/output_fn will handle all the
   patterns in a single pass.
 
-  Instead of returning a single int, returns an array of ints as long as the
-  number of patterns (pattern_count).
+  `report` is called with the index of the pattern and the offset of each
+  match.
 */
-std::vector<int> aho_corasick(std::vector<MultiPatternData> const &pat_data,
-                              std::string const &sequence) {
+template <typename Report>
+void aho_corasick(AhoCorasickPatterns const &pat_data,
+                  std::string_view sequence, Report report) {
+  if (pat_data.backend == GotoBackend::DoubleArray) {
+    aho_corasick_double_array(pat_data, sequence, report);
+    return;
+  }
+
   // Unpack pat_data
-  int pattern_count = std::get<int>(pat_data[0]);
-  auto const &goto_fn = std::get<std::vector<std::vector<int>>>(pat_data[1]);
-  auto const &failure_fn = std::get<std::vector<int>>(pat_data[2]);
-  auto const &output_fn = std::get<std::vector<std::set<int>>>(pat_data[3]);
+  auto const &goto_fn = pat_data.goto_fn;
+  auto const &failure_fn = pat_data.failure_fn;
+  int const *offsets = pat_data.output_fn.offsets.data();
+  int const *patterns = pat_data.output_fn.patterns.data();
+  auto const &lengths = pat_data.lengths;
 
   int state = 0;
   int n = sequence.length();
-  std::vector<int> matches;
-  matches.resize(pattern_count, 0);
 
   for (int i = 0; i < n; i++) {
     while (goto_fn[state][sequence[i]] == FAIL)
       state = failure_fn[state];
 
     state = goto_fn[state][sequence[i]];
-    for (std::set<int>::iterator idx = output_fn[state].begin();
-         idx != output_fn[state].end(); idx++)
-      matches[*idx]++;
+    for (int k = offsets[state]; k < offsets[state + 1]; k++)
+      report(patterns[k], i + 1 - lengths[patterns[k]]);
+  }
+}
+
+/*
+  The count-only form of the above. Instead of returning a single int, returns
+  an array of ints as long as the number of patterns (pattern_count).
+*/
+std::vector<int> aho_corasick(AhoCorasickPatterns const &pat_data,
+                              std::string_view sequence) {
+  std::vector<int> matches(pat_data.pattern_count, 0);
+  aho_corasick(pat_data, sequence,
+               [&](int pattern, std::size_t) { matches[pattern]++; });
+
+  return matches;
+}
+
+/*
+  The engine that hands the two functions above to the runner.
+*/
+struct AhoCorasick {
+  typedef AhoCorasickPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_aho_corasick(patterns);
+  }
+  static Compiled init(std::vector<std::string_view> const &patterns,
+                       WorkPool &pool) {
+    return init_aho_corasick(patterns, GotoBackend::Table, &pool);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return aho_corasick(pat_data, sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    aho_corasick(pat_data, sequence, report);
+  }
+};
+
+/*
+  The same machine with the double-array goto function.
+*/
+struct AhoCorasickDoubleArray {
+  typedef AhoCorasickPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_aho_corasick(patterns, GotoBackend::DoubleArray);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return aho_corasick(pat_data, sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    aho_corasick(pat_data, sequence, report);
+  }
+};
+
+/*
+  The lazy DFA variant. The full DFA below takes a row of delta for every
+  state, which is too much for a big enough dictionary; the double-array
+  machine is small, but follows failure links on the way. This keeps the
+  double-array machine, and makes the DFA transitions from it only as the
+  search comes to need them, in a cache of bounded size.
+
+  The cache is direct-mapped: the transition on `code` from `state` has the
+  one slot (state * 4 + code) mod the size of the cache, where it takes the
+  place of whatever was there. With few enough states, each transition has
+  a slot of its own, and once they have all been seen the machine is the full
+  DFA; with more, the hot states keep their transitions in the cache and the
+  rest go by the failure links, at the cost of a miss each time.
+
+  The search does not change pat_data, so each thread has a cache of its own,
+  which is kept from one sequence to the next for as long as it searches the
+  same patterns.
+*/
+
+// The most entries in the cache (8 bytes each).
+constexpr std::size_t LAZY_CACHE_ENTRIES = std::size_t{1} << 16;
+
+/*
+  The pre-processed form of the patterns, as used by aho_corasick_lazy().
+  `id` tells the threads' caches which machine they are for, and is different
+  for every one made.
+*/
+struct AhoCorasickLazyPatterns {
+  AhoCorasickPatterns machine;
+  std::size_t cache_entries;
+  unsigned long id;
+};
+
+AhoCorasickLazyPatterns
+init_aho_corasick_lazy(std::vector<std::string_view> const &patterns_data) {
+  static std::atomic<unsigned long> next_id{1};
+
+  AhoCorasickPatterns machine =
+      init_aho_corasick(patterns_data, GotoBackend::DoubleArray);
+  std::size_t transitions = machine.double_array.size() * OFFSETS_COUNT;
+  std::size_t cache_entries =
+      std::min(std::bit_ceil(transitions), LAZY_CACHE_ENTRIES);
+
+  return {std::move(machine), cache_entries, next_id++};
+}
+
+/*
+  One thread's cache of transitions. An entry's key is state * 4 + code, or
+  EMPTY if it has not been filled in.
+*/
+struct LazyTransitionCache {
+  struct Entry {
+    std::uint32_t key;
+    std::uint32_t next;
+  };
+  static constexpr std::uint32_t EMPTY = ~std::uint32_t{0};
+
+  unsigned long id = 0;
+  std::vector<Entry> entries;
+
+  // Make the cache ready for the given machine, emptying it if it was last
+  // used for another.
+  void reset(AhoCorasickLazyPatterns const &pat_data) {
+    if (id == pat_data.id)
+      return;
+    id = pat_data.id;
+    entries.assign(pat_data.cache_entries, {EMPTY, 0});
+  }
+};
+
+template <typename Report>
+void aho_corasick_lazy(AhoCorasickLazyPatterns const &pat_data,
+                       std::string_view sequence, Report report) {
+  static thread_local LazyTransitionCache cache;
+  cache.reset(pat_data);
+
+  // Unpack pat_data
+  auto const &machine = pat_data.machine;
+  DoubleArrayCell const *cells = machine.double_array.data();
+  int const *failure_fn = machine.failure_fn.data();
+  int const *offsets = machine.output_fn.offsets.data();
+  int const *patterns = machine.output_fn.patterns.data();
+  auto const &lengths = machine.lengths;
+  LazyTransitionCache::Entry *entries = cache.entries.data();
+  std::uint32_t mask = pat_data.cache_entries - 1;
+
+  std::uint32_t state = 0;
+  int n = sequence.length();
+
+  for (int i = 0; i < n; i++) {
+    std::uint8_t code = BASE_CODES[(unsigned char)sequence[i]];
+    if (code == NOT_BASE) {
+      state = 0;
+      continue;
+    }
+
+    std::uint32_t key = state * OFFSETS_COUNT + code;
+    LazyTransitionCache::Entry &entry = entries[key & mask];
+    if (entry.key != key)
+      entry = {key, std::uint32_t(double_array_step(cells, failure_fn, state,
+                                                    code))};
+    state = entry.next;
+
+    for (int k = offsets[state]; k < offsets[state + 1]; k++)
+      report(patterns[k], i + 1 - lengths[patterns[k]]);
   }
+}
+
+std::vector<int> aho_corasick_lazy(AhoCorasickLazyPatterns const &pat_data,
+                                   std::string_view sequence) {
+  std::vector<int> matches(pat_data.machine.pattern_count, 0);
+  aho_corasick_lazy(pat_data, sequence,
+                    [&](int pattern, std::size_t) { matches[pattern]++; });
 
   return matches;
 }
 
+struct AhoCorasickLazy {
+  typedef AhoCorasickLazyPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_aho_corasick_lazy(patterns);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return aho_corasick_lazy(pat_data, sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    aho_corasick_lazy(pat_data, sequence, report);
+  }
+};
+
+/*
+  The DFA variant. The goto and failure functions are compiled into the full
+  transition function (delta) over the four bases, stored in one flat table
+  with a row of four entries per state. Searching then takes exactly one table
+  look-up per character, with no failure transitions to follow, and the table
+  is a 32nd of the size of the goto function.
+
+  For small dictionaries, the outputs of each state are kept as a bitmask
+  over the pattern numbers rather than in the output function. That takes
+  one look-up per character where the output function's offsets take two,
+  and the matches are read off the mask a set bit at a time. Up to 64
+  patterns, the state's mask is one word; up to 512, it is eight, which only
+  the states with outputs have. Which form is used is decided by
+  init_aho_corasick_dfa() from the number of patterns.
+*/
+
+// The most patterns whose outputs fit in one word, and in eight.
+constexpr int SMALL_BITSET_PATTERNS = 64;
+constexpr int LARGE_BITSET_PATTERNS = 512;
+constexpr int LARGE_BITSET_WORDS = LARGE_BITSET_PATTERNS / 64;
+
+/*
+  The pre-processed form of the patterns, as used by aho_corasick_dfa(). The
+  outputs are in output_fn if bitset_words is 0, and otherwise in
+  output_bits: with one word, bit b of output_bits[state] is set if pattern b
+  ends at the state (or further down its failure chain); with eight, it is 0
+  if no pattern does, and otherwise one more than the number of the state's
+  block of words in output_words, laid out the same way.
+*/
+struct AhoCorasickDfaPatterns {
+  int pattern_count;
+  // delta[state * OFFSETS_COUNT + code] is the next state.
+  std::vector<std::uint32_t> delta;
+  OutputFunction output_fn;
+  int bitset_words;
+  std::vector<std::uint64_t> output_bits;
+  std::vector<std::uint64_t> output_words;
+  std::vector<int> lengths;
+};
+
+/*
+  Compile the goto and failure functions into the delta table. The rows are
+  filled in breadth-first, so that the row for the failure state of each
+  state is always complete before it is needed: where the goto function
+  fails, delta takes the failure state's transition instead.
+*/
+std::vector<std::uint32_t> build_delta(AhoCorasickBuilder const &machine) {
+  auto const &goto_fn = machine.goto_fn;
+  auto const &failure_fn = machine.failure_fn;
+  std::vector<std::uint32_t> delta(machine.states * OFFSETS_COUNT);
+
+  for (int i = 0; i < OFFSETS_COUNT; i++)
+    delta[i] = goto_fn[0][ALPHA_OFFSETS[i]];
+  for (int state : machine.order)
+    for (int i = 0; i < OFFSETS_COUNT; i++) {
+      int next = goto_fn[state][ALPHA_OFFSETS[i]];
+      delta[state * OFFSETS_COUNT + i] =
+          next == FAIL ? delta[failure_fn[state] * OFFSETS_COUNT + i] : next;
+    }
+
+  return delta;
+}
+
+/*
+  Turn the output function into the bitmasks, of pat_data.bitset_words words.
+*/
+void build_output_bits(OutputFunction const &output_fn,
+                       AhoCorasickDfaPatterns &pat_data) {
+  auto &output_bits = pat_data.output_bits;
+  auto &output_words = pat_data.output_words;
+  output_bits.assign(output_fn.offsets.size() - 1, 0);
+
+  for (std::size_t state = 0; state < output_bits.size(); state++) {
+    int first = output_fn.offsets[state];
+    int last = output_fn.offsets[state + 1];
+    if (first == last)
+      continue;
+    std::uint64_t *bits = &output_bits[state];
+    if (pat_data.bitset_words > 1) {
+      output_bits[state] = output_words.size() / LARGE_BITSET_WORDS + 1;
+      output_words.resize(output_words.size() + LARGE_BITSET_WORDS, 0);
+      bits = &output_words[output_words.size() - LARGE_BITSET_WORDS];
+    }
+    for (int k = first; k < last; k++) {
+      int pattern = output_fn.patterns[k];
+      bits[pattern / 64] |= std::uint64_t{1} << (pattern % 64);
+    }
+  }
+}
+
+AhoCorasickDfaPatterns
+init_aho_corasick_dfa(std::vector<std::string_view> const &patterns_data,
+                      WorkPool *pool = nullptr) {
+  int patterns_count = patterns_data.size();
+  check_bases(patterns_data, "aho_corasick_dfa");
+
+  WorkPool serial{1};
+  AhoCorasickBuilder machine{patterns_data, pool ? *pool : serial};
+  OutputFunction output_fn = build_outputs(machine);
+  std::vector<std::uint32_t> delta = build_delta(machine);
+
+  std::vector<int> lengths;
+  for (auto const &pattern : patterns_data)
+    lengths.push_back(pattern.length());
+
+  AhoCorasickDfaPatterns pat_data{
+      patterns_count, std::move(delta), {}, 0, {}, {}, lengths};
+  if (patterns_count <= SMALL_BITSET_PATTERNS)
+    pat_data.bitset_words = 1;
+  else if (patterns_count <= LARGE_BITSET_PATTERNS)
+    pat_data.bitset_words = LARGE_BITSET_WORDS;
+
+  if (pat_data.bitset_words == 0)
+    pat_data.output_fn = std::move(output_fn);
+  else
+    build_output_bits(output_fn, pat_data);
+
+  return pat_data;
+}
+
+/*
+  The search with bitmask outputs. Each set bit is a match, taken lowest
+  first; for most states, there is just the test of the one word.
+*/
+template <int WORDS, typename Report>
+void aho_corasick_dfa_bitset(AhoCorasickDfaPatterns const &pat_data,
+                             std::string_view sequence, Report report) {
+  // Unpack pat_data
+  std::uint32_t const *delta = pat_data.delta.data();
+  std::uint64_t const *output_bits = pat_data.output_bits.data();
+  std::uint64_t const *output_words = pat_data.output_words.data();
+  auto const &lengths = pat_data.lengths;
+
+  std::uint32_t state = 0;
+  int n = sequence.length();
+
+  for (int i = 0; i < n; i++) {
+    std::uint8_t code = BASE_CODES[(unsigned char)sequence[i]];
+    if (code == NOT_BASE) {
+      state = 0;
+      continue;
+    }
+
+    state = delta[state * OFFSETS_COUNT + code];
+    std::uint64_t outputs = output_bits[state];
+    if (outputs == 0)
+      continue;
+    std::uint64_t const *words = &outputs;
+    if constexpr (WORDS > 1)
+      words = output_words + (outputs - 1) * WORDS;
+    for (int word = 0; word < WORDS; word++)
+      for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+        int pattern = word * 64 + std::countr_zero(bits);
+        report(pattern, i + 1 - lengths[pattern]);
+      }
+  }
+}
+
+/*
+  Run the DFA against the given sequence, calling `report` as aho_corasick()
+  does. A character that is not one of the bases cannot be part of any match,
+  so it just sends the machine back to the start state.
+*/
+template <typename Report>
+void aho_corasick_dfa(AhoCorasickDfaPatterns const &pat_data,
+                      std::string_view sequence, Report report) {
+  if (pat_data.bitset_words == 1)
+    return aho_corasick_dfa_bitset<1>(pat_data, sequence, report);
+  if (pat_data.bitset_words == LARGE_BITSET_WORDS)
+    return aho_corasick_dfa_bitset<LARGE_BITSET_WORDS>(pat_data, sequence,
+                                                       report);
+
+  // Unpack pat_data
+  std::uint32_t const *delta = pat_data.delta.data();
+  int const *offsets = pat_data.output_fn.offsets.data();
+  int const *patterns = pat_data.output_fn.patterns.data();
+  auto const &lengths = pat_data.lengths;
+
+  std::uint32_t state = 0;
+  int n = sequence.length();
+
+  for (int i = 0; i < n; i++) {
+    std::uint8_t code = BASE_CODES[(unsigned char)sequence[i]];
+    if (code == NOT_BASE) {
+      state = 0;
+      continue;
+    }
+
+    state = delta[state * OFFSETS_COUNT + code];
+    for (int k = offsets[state]; k < offsets[state + 1]; k++)
+      report(patterns[k], i + 1 - lengths[patterns[k]]);
+  }
+}
+
+std::vector<int> aho_corasick_dfa(AhoCorasickDfaPatterns const &pat_data,
+                                  std::string_view sequence) {
+  std::vector<int> matches(pat_data.pattern_count, 0);
+  aho_corasick_dfa(pat_data, sequence,
+                   [&](int pattern, std::size_t) { matches[pattern]++; });
+
+  return matches;
+}
+
+struct AhoCorasickDfa {
+  typedef AhoCorasickDfaPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_aho_corasick_dfa(patterns);
+  }
+  static Compiled init(std::vector<std::string_view> const &patterns,
+                       WorkPool &pool) {
+    return init_aho_corasick_dfa(patterns, &pool);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return aho_corasick_dfa(pat_data, sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    aho_corasick_dfa(pat_data, sequence, report);
+  }
+};
+
+/*
+  The counting variant. This runs the same DFA, but rather than walk the
+  outputs of every state it enters, it only counts how often it was in each
+  state, and works out the pattern counts from those at the end of the
+  sequence.
+
+  A pattern is matched every time the machine enters a state whose failure
+  chain passes through the state where the pattern ends, so its count is the
+  sum of the visits over all such states: the subtree under that state in
+  the tree made by the failure links. The totals are made by adding each
+  state's visits into its failure state, in reverse breadth-first order.
+
+  Only the states where some pattern ends matter for that, so the visits are
+  not kept per state but per "slot", one for each of those states. Every
+  state is given the slot of the nearest of them on its failure chain
+  (itself included), or slot 0 if there is none; each slot has the slot
+  further down the chain as its parent. The search loop is then just the
+  transition and one increment, and the pass at the end is over the slots,
+  of which there are no more than there are patterns.
+
+  This can only count. There is no way of saying where the matches were.
+*/
+struct AhoCorasickCountPatterns {
+  int pattern_count;
+  std::vector<std::uint32_t> delta;
+  std::vector<std::uint32_t> slot;
+  std::vector<std::uint32_t> parent_slot;
+  // The slot of the state where each pattern ends.
+  std::vector<std::uint32_t> pattern_slot;
+};
+
+AhoCorasickCountPatterns
+init_aho_corasick_count(std::vector<std::string_view> const &patterns_data,
+                        WorkPool *pool = nullptr) {
+  int patterns_count = patterns_data.size();
+  check_bases(patterns_data, "aho_corasick_count");
+
+  WorkPool serial{1};
+  AhoCorasickBuilder machine{patterns_data, pool ? *pool : serial};
+  std::vector<std::uint32_t> delta = build_delta(machine);
+  auto const &first_output = machine.first_output;
+  auto const &next_output = machine.next_output;
+  auto const &failure_fn = machine.failure_fn;
+
+  // Slots are handed out breadth-first, so a slot's parent always has a
+  // lower number than it does.
+  std::vector<std::uint32_t> slot(machine.states, 0);
+  std::vector<std::uint32_t> parent_slot{0};
+  std::vector<std::uint32_t> pattern_slot(patterns_count, 0);
+  for (int state : machine.order) {
+    if (first_output[state] == FAIL) {
+      slot[state] = slot[failure_fn[state]];
+      continue;
+    }
+
+    slot[state] = parent_slot.size();
+    parent_slot.push_back(slot[failure_fn[state]]);
+    for (int idx = first_output[state]; idx != FAIL; idx = next_output[idx])
+      pattern_slot[idx] = slot[state];
+  }
+
+  return {patterns_count, delta, slot, parent_slot, pattern_slot};
+}
+
+/*
+  Turn the visits to each slot into the totals for each slot, by pushing them
+  down the failure chains. Slot 0 collects the visits to states that match
+  nothing, and is never read.
+*/
+void total_visits(AhoCorasickCountPatterns const &pat_data, int *visits) {
+  auto const &parent_slot = pat_data.parent_slot;
+
+  for (std::size_t idx = parent_slot.size() - 1; idx > 0; idx--)
+    visits[parent_slot[idx]] += visits[idx];
+}
+
+std::vector<int> aho_corasick_count(AhoCorasickCountPatterns const &pat_data,
+                                    std::string_view sequence) {
+  // Unpack pat_data
+  std::uint32_t const *delta = pat_data.delta.data();
+  std::uint32_t const *slot = pat_data.slot.data();
+  auto const &pattern_slot = pat_data.pattern_slot;
+
+  std::uint32_t state = 0;
+  int n = sequence.length();
+  std::vector<int> visits(pat_data.parent_slot.size(), 0);
+
+  for (int i = 0; i < n; i++) {
+    std::uint8_t code = BASE_CODES[(unsigned char)sequence[i]];
+    if (code == NOT_BASE) {
+      state = 0;
+      continue;
+    }
+
+    state = delta[state * OFFSETS_COUNT + code];
+    visits[slot[state]]++;
+  }
+
+  total_visits(pat_data, visits.data());
+
+  std::vector<int> matches(pat_data.pattern_count);
+  for (int pattern = 0; pattern < pat_data.pattern_count; pattern++)
+    matches[pattern] = visits[pattern_slot[pattern]];
+
+  return matches;
+}
+
+struct AhoCorasickCount {
+  typedef AhoCorasickCountPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_aho_corasick_count(patterns);
+  }
+  static Compiled init(std::vector<std::string_view> const &patterns,
+                       WorkPool &pool) {
+    return init_aho_corasick_count(patterns, &pool);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return aho_corasick_count(pat_data, sequence);
+  }
+};
+
+/*
+  The interleaved variant. This is the counting DFA again, but it searches a
+  block of sequences at a time, a number of them (LANES) in lockstep: each
+  step takes one character from every lane. With a large dictionary, the
+  table does not fit in the cache and nearly every transition is a miss; one
+  sequence at a time, each of those has to wait for the one before it, as the
+  state it loads is needed to find the next. The lanes are independent of
+  each other, so their misses can all be waiting at once, and the row for
+  each lane's next state is prefetched as soon as the state is known.
+
+  A lane that reaches the end of its sequence starts on the next in the
+  block. The lockstep runs for as long as there are sequences to give every
+  lane, and the last few are finished off one at a time.
+*/
+constexpr int LANES = 8;
+
+void aho_corasick_interleaved(AhoCorasickCountPatterns const &pat_data,
+                              SequenceData const &sequences, std::size_t begin,
+                              std::size_t end, MatchTable &results) {
+  // Unpack pat_data
+  std::uint32_t const *delta = pat_data.delta.data();
+  std::uint32_t const *slot = pat_data.slot.data();
+  auto const &pattern_slot = pat_data.pattern_slot;
+  std::size_t slots = pat_data.parent_slot.size();
+
+  // Each lane's visits, and where it is up to in which sequence.
+  std::vector<int> visits(LANES * slots, 0);
+  std::size_t sequence[LANES], position[LANES], length[LANES];
+  char const *text[LANES];
+  std::uint32_t state[LANES];
+  bool idle[LANES] = {};
+  std::size_t next = begin;
+
+  // Set a lane going on the next sequence, if there is one.
+  auto start = [&](int lane) {
+    if (next == end)
+      return false;
+    sequence[lane] = next++;
+    text[lane] = sequences[sequence[lane]].data();
+    length[lane] = sequences[sequence[lane]].length();
+    position[lane] = 0;
+    state[lane] = 0;
+    return true;
+  };
+  // Record the counts for a lane's sequence, and clear its visits.
+  auto finish = [&](int lane) {
+    int *counts = visits.data() + lane * slots;
+    total_visits(pat_data, counts);
+    for (int pattern = 0; pattern < pat_data.pattern_count; pattern++)
+      results.set(pattern, sequence[lane], counts[pattern_slot[pattern]]);
+    std::fill(counts, counts + slots, 0);
+  };
+  // Take one lane a step, from `state` on character `c`.
+  auto step = [&](int lane, char c) {
+    std::uint8_t code = BASE_CODES[(unsigned char)c];
+    std::uint32_t next_state =
+        code == NOT_BASE ? 0 : delta[state[lane] * OFFSETS_COUNT + code];
+    state[lane] = next_state;
+    __builtin_prefetch(delta + next_state * OFFSETS_COUNT);
+    visits[lane * slots + slot[next_state]]++;
+  };
+
+  int lanes = 0;
+  while (lanes < LANES && start(lanes))
+    lanes++;
+
+  bool full = lanes == LANES;
+  while (full) {
+    // Run every lane as far as the first of them can go.
+    std::size_t steps = length[0] - position[0];
+    for (int lane = 1; lane < LANES; lane++)
+      steps = std::min(steps, length[lane] - position[lane]);
+
+    for (std::size_t idx = 0; idx < steps; idx++)
+      for (int lane = 0; lane < LANES; lane++)
+        step(lane, text[lane][position[lane] + idx]);
+
+    for (int lane = 0; lane < LANES; lane++) {
+      position[lane] += steps;
+      if (position[lane] < length[lane] || !full)
+        continue;
+      finish(lane);
+      if (!start(lane)) {
+        idle[lane] = true;
+        full = false;
+      }
+    }
+  }
+
+  // Finish whatever the lanes were still working on, one at a time.
+  for (int lane = 0; lane < lanes; lane++) {
+    if (idle[lane])
+      continue;
+    for (; position[lane] < length[lane]; position[lane]++)
+      step(lane, text[lane][position[lane]]);
+    finish(lane);
+  }
+}
+
+struct AhoCorasickInterleaved {
+  typedef AhoCorasickCountPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_aho_corasick_count(patterns);
+  }
+  static Compiled init(std::vector<std::string_view> const &patterns,
+                       WorkPool &pool) {
+    return init_aho_corasick_count(patterns, &pool);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return aho_corasick_count(pat_data, sequence);
+  }
+  static void search_block(Compiled const &pat_data,
+                           SequenceData const &sequences, std::size_t begin,
+                           std::size_t end, MatchTable &results) {
+    aho_corasick_interleaved(pat_data, sequences, begin, end, results);
+  }
+};
+
+// Make the engines available to the combined binary as well.
+static RegisterEngine<AhoCorasick> registration{"aho_corasick"};
+static RegisterEngine<AhoCorasickDoubleArray> double_array_registration{
+    "aho_corasick_double_array"};
+static RegisterEngine<AhoCorasickLazy> lazy_registration{"aho_corasick_lazy"};
+static RegisterEngine<AhoCorasickDfa> dfa_registration{"aho_corasick_dfa"};
+static RegisterEngine<AhoCorasickCount> count_registration{
+    "aho_corasick_count"};
+static RegisterEngine<AhoCorasickInterleaved> interleaved_registration{
+    "aho_corasick_interleaved"};
+
+#ifndef MULTI_ENGINE
 /*
-  All that is done here is call the run() function with the argc/argv values.
+  All that is done here is call the run_multi() function with the algorithm's
+  engine, the label for the algorithm, and the argc/argv values.
 */
 int main(int argc, char *argv[]) {
-  int return_code =
-      run_multi(&init_aho_corasick, &aho_corasick, "aho_corasick", argc, argv);
+  int return_code = run_multi<AhoCorasick>("aho_corasick", argc, argv);
 
   return return_code;
 }
+#endif // !MULTI_ENGINE
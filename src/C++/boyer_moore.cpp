@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "run.hpp"
@@ -69,38 +70,43 @@ void calc_good_suffix(std::string const &pat, int m,
     good_suffix[m - 1 - suffixes[i]] = m - 1 - i;
 }
 
-std::vector<PatternData> init_boyer_moore(std::string const &pattern) {
-  std::vector<PatternData> return_val;
-  return_val.reserve(3);
+/*
+  The pre-processed form of a pattern, as used by boyer_moore().
+*/
+struct BoyerMoorePattern {
+  std::string pattern;
+  std::vector<int> good_suffix;
+  std::vector<int> bad_char;
+};
+
+BoyerMoorePattern init_boyer_moore(std::string_view pattern) {
   int m = pattern.length();
-  // Set up a copy of pattern, with the sentinel character added:
-  std::string pat(pattern + "\0");
+  // Set up a copy of pattern, which also has the '\0' sentinel after it:
+  std::string pat{pattern};
   // Declare and initialize the good_suffix and bad_char vectors:
   std::vector<int> good_suffix(m, 0), bad_char(ASIZE, m);
 
   calc_good_suffix(pat, m, good_suffix);
   calc_bad_char(pat, m, bad_char);
 
-  return_val.push_back(pat);
-  return_val.push_back(good_suffix);
-  return_val.push_back(bad_char);
-
-  return return_val;
+  return {pat, good_suffix, bad_char};
 }
 
 /*
   Perform the Boyer-Moore algorithm on the given pattern of length m,
-  against the sequence of length n.
+  against the sequence of length n. `report` is called with the offset of
+  each match.
 */
-int boyer_moore(std::vector<PatternData> const &pat_data,
-                std::string const &sequence) {
+template <typename Report>
+int boyer_moore(BoyerMoorePattern const &pat_data, std::string_view sequence,
+                Report report) {
   int i, j;
   int matches = 0;
 
   // Unpack pat_data:
-  std::string pattern = std::get<std::string>(pat_data[0]);
-  auto const &good_suffix = std::get<std::vector<int>>(pat_data[1]);
-  auto const &bad_char = std::get<std::vector<int>>(pat_data[2]);
+  auto const &pattern = pat_data.pattern;
+  auto const &good_suffix = pat_data.good_suffix;
+  auto const &bad_char = pat_data.bad_char;
 
   // Get the size of the pattern and the sequence.
   int m = pattern.length();
@@ -113,6 +119,7 @@ int boyer_moore(std::vector<PatternData> const &pat_data,
       ;
     if (i < 0) {
       matches++;
+      report(j);
       j += good_suffix[0];
     } else {
       j += std::max(good_suffix[i], bad_char[sequence[i + j]] - m + 1 + i);
@@ -123,13 +130,34 @@ int boyer_moore(std::vector<PatternData> const &pat_data,
 }
 
 /*
-  All that is done here is call the run() function with a pointer to the
-  algorithm implementation, the label for the algorithm, and the argc/argv
-  values.
+  The engine that hands the two functions above to the runner.
+*/
+struct BoyerMoore {
+  typedef BoyerMoorePattern Compiled;
+  static Compiled init(std::string_view pattern) {
+    return init_boyer_moore(pattern);
+  }
+  static int search(Compiled const &pat_data, std::string_view sequence) {
+    return boyer_moore(pat_data, sequence, IgnoreMatch{});
+  }
+  template <typename Report>
+  static int search(Compiled const &pat_data, std::string_view sequence,
+                    Report report) {
+    return boyer_moore(pat_data, sequence, report);
+  }
+};
+
+// Make the engine available to the combined binary as well.
+static RegisterEngine<BoyerMoore> registration{"boyer_moore"};
+
+#ifndef MULTI_ENGINE
+/*
+  All that is done here is call the run() function with the algorithm's
+  engine, the label for the algorithm, and the argc/argv values.
 */
 int main(int argc, char *argv[]) {
-  int return_code =
-      run(&init_boyer_moore, &boyer_moore, "boyer_moore", argc, argv);
+  int return_code = run<BoyerMoore>("boyer_moore", argc, argv);
 
   return return_code;
 }
+#endif // !MULTI_ENGINE
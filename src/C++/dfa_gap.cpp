@@ -3,42 +3,88 @@
   approximate string matching.
 */
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include "run.hpp"
 
-// Rather than implement a translation table for the four characters in the DNA
-// alphabet, for now just let the alphabet be the full ASCII range and only use
-// those four.
-constexpr int ASIZE = 128;
-
-// The "fail" value is used to determine when to start over.
-constexpr int FAIL = -1;
+/*
+  The DFA's columns. Rather than a column for every character, the four bases
+  of the DNA alphabet have the first four, and any other characters that a
+  pattern has get one each after those. One more column, in which every
+  transition fails, is shared by all of the characters that the pattern does
+  not have. So for a pattern of bases alone, a row has five transitions.
+*/
+struct DfaColumns {
+  std::array<std::uint8_t, 256> column;
+  int count;
+};
 
 /*
   The ALPHABET/ALPHABET_COUNT values are used when setting up the transitions
-  around the "gap" states in the DFA. Since we're being lazy about translating
-  ACGT to 0-3 and using an alphabet of 128 instead, this will save some time in
-  loops during the creation of the DFA.
+  around the "gap" states in the DFA, which are for the four bases only.
 */
 constexpr int ALPHABET_COUNT = 4;
 static const std::array<int, ALPHABET_COUNT> ALPHABET = {65, 67, 71, 84};
 
-void create_dfa(std::string const &pattern, int m, int k,
-                std::vector<std::vector<int>> &dfa, int &terminal) {
-  // We know that the number of states will be 1 + m + k(m - 1).
-  int max_states = 1 + m + k * (m - 1);
+/*
+  Number the columns for the characters of `pattern`.
+*/
+DfaColumns make_columns(std::string_view pattern) {
+  DfaColumns columns;
+  columns.column.fill(0);
+  for (int n = 0; n < ALPHABET_COUNT; n++)
+    columns.column[ALPHABET[n]] = n + 1;
+  columns.count = ALPHABET_COUNT;
+  for (char c : pattern)
+    if (columns.column[(unsigned char)c] == 0)
+      columns.column[(unsigned char)c] = ++columns.count;
+
+  // Characters numbered 0 above, which is all but those seen, go to the
+  // failing column.
+  for (auto &column : columns.column)
+    column = column == 0 ? columns.count : column - 1;
+  columns.count++;
+
+  return columns;
+}
+
+/*
+  Build the DFA for `pattern` into `dfa`, a row of `columns.count` entries for
+  each state. `State` is the type of an entry, and its largest value stands
+  for a failed transition. The caller picks the narrowest type that holds
+  every offset into the table, so that the table stays small.
+
+  `gaps` gets an entry for each state: the number of gap characters that the
+  state has seen since the last character of the pattern was matched (0 for
+  a state that has just matched one). Only the search that counts for every
+  k at once looks at these (see dfa_gap_all_k()), so they are kept out of
+  the table.
+*/
+template <typename State>
+void create_dfa(std::string_view pattern, int m, int k, long max_states,
+                DfaColumns const &columns, std::vector<State> &dfa,
+                std::vector<int> &gaps, int &terminal) {
+  constexpr State FAIL = std::numeric_limits<State>::max();
+  int width = columns.count;
+  auto const &column = columns.column;
 
   // Allocate for the DFA
-  dfa.resize(max_states, std::vector<int>(ASIZE, FAIL));
+  dfa.assign(max_states * width, FAIL);
+  gaps.assign(max_states, 0);
 
   // Start building the DFA. Start with state 0 and iterate through the
   // characters of `pattern`.
 
   // First step: Set d(0, p_0) = state(1)
-  dfa[0][pattern[0]] = 1;
+  dfa[column[(unsigned char)pattern[0]]] = 1;
 
   // Start `state` and `new_state` both at 1
   int state = 1, new_state = 1;
@@ -47,22 +93,24 @@ void create_dfa(std::string const &pattern, int m, int k,
   // size of the DFA, there is no need to initialize each new state, that's
   // been done already.
   for (int i = 1; i < m; i++) {
+    int code = column[(unsigned char)pattern[i]];
     // Move `new_state` to the next place.
     new_state++;
     // The previous `state` maps to `new_state` on `pattern[i]`
-    dfa[state][pattern[i]] = new_state;
+    dfa[state * width + code] = new_state;
     // `last_state` is used to control setting transitions for other values
     int last_state = state;
     for (int j = 1; j <= k; j++) {
       // For each of 1..k, we start a new state for which `pattern[i]` maps to
       // `new_state`.
-      dfa[(new_state + j)][pattern[i]] = new_state;
+      dfa[(new_state + j) * width + code] = new_state;
+      gaps[new_state + j] = j;
       for (int n = 0; n < ALPHABET_COUNT; n++) {
-        if (ALPHABET[n] == pattern[i])
+        if (n == code)
           continue;
         // Every character that isn't `pattern[i]` needs to map `last_state` to
         // this new state-value.
-        dfa[last_state][ALPHABET[n]] = new_state + j;
+        dfa[last_state * width + n] = new_state + j;
       }
       // Shift `last_state` for the next iteration.
       last_state = new_state + j;
@@ -75,41 +123,85 @@ void create_dfa(std::string const &pattern, int m, int k,
 
   // At completion, the value of `state` is our terminal.
   terminal = state;
+
+  // Store each state as the offset of its row, which saves the search a
+  // multiplication on every step.
+  for (long row = 0; row < max_states; row++)
+    for (int code = 0; code < width; code++)
+      if (dfa[row * width + code] != FAIL)
+        dfa[row * width + code] *= width;
+  terminal *= width;
   return;
 }
 
 /*
-  Initialize the pattern given. Return a 3-element array of the DFA from
-  processing the pattern, the terminal state, and the pattern length m. The
-  original pattern will not be needed for matching.
+  The pre-processed form of a pattern, as used by dfa_gap(): the DFA from
+  processing the pattern, the gap count of each state, the terminal state,
+  and the pattern length m. The original pattern will not be needed for
+  matching.
+
+  The DFA is a single array, in which a state is the offset of its row. The
+  entries are one byte wide when the whole table has up to 255 of them, two
+  bytes up to 65,535, and four bytes past that. `state_bytes` says which, and
+  only that one of the three tables is filled.
 */
-std::vector<MultiPatternData> init_dfa_gap(std::string const &pattern, int k) {
-  std::vector<MultiPatternData> return_val;
-  return_val.reserve(3);
+struct DfaGapPattern {
+  DfaColumns columns;
+  int state_bytes;
+  std::vector<std::uint8_t> dfa8;
+  std::vector<std::uint16_t> dfa16;
+  std::vector<std::uint32_t> dfa32;
+  std::vector<int> gaps;
+  int terminal;
+  int m;
+};
 
+/*
+  Initialize the pattern given, for gaps of up to k characters.
+*/
+DfaGapPattern init_dfa_gap(std::string_view pattern, int k) {
   // Set up the DFA structure for the algorithm to use:
-  int m = pattern.length();
-  int terminal;
-  std::vector<std::vector<int>> dfa;
-  create_dfa(pattern, m, k, dfa, terminal);
+  DfaGapPattern pat_data;
+  pat_data.m = pattern.length();
+  pat_data.columns = make_columns(pattern);
+  if (pat_data.m == 0) {
+    pat_data.state_bytes = 0;
+    pat_data.terminal = 0;
+    return pat_data;
+  }
 
-  return_val.push_back(dfa);
-  return_val.push_back(terminal);
-  return_val.push_back(m);
+  // The largest value of each type is kept for a failed transition. We know
+  // that the number of states will be 1 + m + k(m - 1).
+  long max_states = 1 + pat_data.m + (long)k * (pat_data.m - 1);
+  long size = max_states * pat_data.columns.count;
+  if (size <= 0xff) {
+    pat_data.state_bytes = 1;
+    create_dfa(pattern, pat_data.m, k, max_states, pat_data.columns,
+               pat_data.dfa8, pat_data.gaps, pat_data.terminal);
+  } else if (size <= 0xffff) {
+    pat_data.state_bytes = 2;
+    create_dfa(pattern, pat_data.m, k, max_states, pat_data.columns,
+               pat_data.dfa16, pat_data.gaps, pat_data.terminal);
+  } else {
+    pat_data.state_bytes = 4;
+    create_dfa(pattern, pat_data.m, k, max_states, pat_data.columns,
+               pat_data.dfa32, pat_data.gaps, pat_data.terminal);
+  }
 
-  return return_val;
+  return pat_data;
 }
 
 /*
-  Perform the DFA-Gap algorithm on the given (processed) pattern against the
-  given sequence.
+  Run the DFA from every offset of the sequence, with states of type State.
 */
-int dfa_gap(std::vector<MultiPatternData> const &pat_data,
-            std::string const &sequence) {
+template <typename State, typename Report>
+int dfa_gap(DfaGapPattern const &pat_data, State const *dfa,
+            std::string_view sequence, Report report) {
+  constexpr State FAIL = std::numeric_limits<State>::max();
   // Unpack pat_data:
-  auto const &dfa = std::get<std::vector<std::vector<int>>>(pat_data[0]);
-  int terminal = std::get<int>(pat_data[1]);
-  int m = std::get<int>(pat_data[2]);
+  auto const &column = pat_data.columns.column;
+  int terminal = pat_data.terminal;
+  int m = pat_data.m;
 
   int matches = 0;
   int n = sequence.length();
@@ -119,24 +211,487 @@ int dfa_gap(std::vector<MultiPatternData> const &pat_data,
   // an exact pattern match at the very end of `sequence`.
   for (int i = 0; i <= end; i++) {
     int state = 0;
-    int ch = 0;
-    while ((i + ch) < n && dfa[state][sequence[i + ch]] != FAIL)
-      state = dfa[state][sequence[i + ch++]];
+    for (int ch = i; ch < n; ch++) {
+      State next = dfa[state + column[(unsigned char)sequence[ch]]];
+      if (next == FAIL)
+        break;
+      state = next;
+    }
 
-    if (state == terminal)
+    if (state == terminal) {
       matches++;
+      report(i);
+    }
+  }
+
+  return matches;
+}
+
+/*
+  Perform the DFA-Gap algorithm on the given (processed) pattern against the
+  given sequence. `report` is called with the offset of each match.
+*/
+template <typename Report>
+int dfa_gap(DfaGapPattern const &pat_data, std::string_view sequence,
+            Report report) {
+  switch (pat_data.state_bytes) {
+  case 1:
+    return dfa_gap(pat_data, pat_data.dfa8.data(), sequence, report);
+  case 2:
+    return dfa_gap(pat_data, pat_data.dfa16.data(), sequence, report);
+  case 4:
+    return dfa_gap(pat_data, pat_data.dfa32.data(), sequence, report);
+  default:
+    return 0;
+  }
+}
+
+/*
+  Count the matches for every k up to the one the pattern was initialized
+  for, in the one search. A run of the DFA takes the first place that each
+  character of the pattern comes, whatever k is; k only limits how long the
+  gaps before them can be. So a run that matches with k also matches with
+  any k at least as large as its longest gap, and no smaller. That longest
+  gap, j, is taken from the gap counts of the states that the run goes
+  through, and the match is counted in counts[j]. The gap counts are by state
+  number, which is a state's offset over the width of a row.
+*/
+template <typename State>
+void dfa_gap_all_k(DfaGapPattern const &pat_data, State const *dfa,
+                   std::string_view sequence, int *counts) {
+  constexpr State FAIL = std::numeric_limits<State>::max();
+  // Unpack pat_data:
+  auto const &column = pat_data.columns.column;
+  int const *gaps = pat_data.gaps.data();
+  int width = pat_data.columns.count;
+  int terminal = pat_data.terminal;
+  int m = pat_data.m;
+
+  int n = sequence.length();
+  int end = n - m;
+  for (int i = 0; i <= end; i++) {
+    int state = 0, longest = 0;
+    for (int ch = i; ch < n; ch++) {
+      State next = dfa[state + column[(unsigned char)sequence[ch]]];
+      if (next == FAIL)
+        break;
+      state = next;
+      longest = std::max(longest, gaps[state / width]);
+    }
+
+    if (state == terminal)
+      counts[longest]++;
+  }
+}
+
+void dfa_gap_all_k(DfaGapPattern const &pat_data, std::string_view sequence,
+                   int *counts) {
+  switch (pat_data.state_bytes) {
+  case 1:
+    dfa_gap_all_k(pat_data, pat_data.dfa8.data(), sequence, counts);
+    break;
+  case 2:
+    dfa_gap_all_k(pat_data, pat_data.dfa16.data(), sequence, counts);
+    break;
+  case 4:
+    dfa_gap_all_k(pat_data, pat_data.dfa32.data(), sequence, counts);
+    break;
+  }
+}
+
+/*
+  The engine that hands the functions above to the runner.
+*/
+struct DfaGap {
+  typedef DfaGapPattern Compiled;
+  static Compiled init(std::string_view pattern, int k) {
+    return init_dfa_gap(pattern, k);
+  }
+  static int search(Compiled const &pat_data, std::string_view sequence) {
+    return dfa_gap(pat_data, sequence, IgnoreMatch{});
+  }
+  template <typename Report>
+  static int search(Compiled const &pat_data, std::string_view sequence,
+                    Report report) {
+    return dfa_gap(pat_data, sequence, report);
+  }
+  static void search_gaps(Compiled const &pat_data, std::string_view sequence,
+                          int *counts) {
+    dfa_gap_all_k(pat_data, sequence, counts);
+  }
+};
+
+/*
+  The seed-and-extend form of DFA-Gap. Most of the offsets that dfa_gap()
+  starts the DFA from fail within a character or two, but finding that out
+  costs a look-up and a hard-to-predict branch for each offset. Here, a
+  filter rules most of them out 64 at a time, and the DFA is only run from
+  the offsets that are left.
+
+  A match does not have to hold any two characters of the pattern side by
+  side (there can be a gap between every pair), so there are no exact seeds
+  of more than one character to look for. What it does have to hold, at an
+  offset s, is pattern[0] at s and then each pattern[j] somewhere in the
+  window from s + j to s + j * (k + 1), since each of the characters before
+  it came at least one and at most k + 1 places after the one before. The
+  filter is those conditions, for the first few characters of the pattern,
+  worked out as in Shift-Or: a bitmap of where each character is in the
+  sequence is spread over the window with shifts and ORs, and the bitmaps
+  for all of the characters are ANDed together. Each condition is necessary,
+  so the filter never loses a match.
+*/
+
+// The most characters of the pattern after the first that the filter uses.
+// The windows grow with j, and let more and more offsets through.
+constexpr int FILTER_DEPTH = 8;
+
+/*
+  The pre-processed form of a pattern, as used by dfa_gap_filter(): that of
+  dfa_gap(), and the columns of the characters that the filter looks for.
+*/
+struct DfaGapFilterPattern {
+  DfaGapPattern dfa;
+  int k;
+  std::vector<int> seeds;
+};
+
+/*
+  Initialize the pattern given, for gaps of up to k characters.
+*/
+DfaGapFilterPattern init_dfa_gap_filter(std::string_view pattern, int k) {
+  DfaGapFilterPattern pat_data{init_dfa_gap(pattern, k), k, {}};
+  int depth = std::min<int>(pattern.length(), FILTER_DEPTH + 1);
+  for (int j = 0; j < depth; j++)
+    pat_data.seeds.push_back(
+        pat_data.dfa.columns.column[(unsigned char)pattern[j]]);
+
+  return pat_data;
+}
+
+/*
+  One thread's bitmaps for the filter, kept from one search to the next. Each
+  has a word for every 64 offsets of the sequence, and then enough words that
+  are always 0 for the longest shift to read past the end.
+*/
+struct DfaGapFilterBitmaps {
+  std::vector<std::uint64_t> columns;
+  std::vector<std::uint64_t> window;
+  std::vector<std::uint64_t> candidates;
+};
+
+/*
+  Bit i of the result is bit i + shift of `bits`, for the word `word`.
+*/
+static inline std::uint64_t shifted_word(std::uint64_t const *bits, int word,
+                                         int shift) {
+  int from = word + shift / 64;
+  int offset = shift % 64;
+  if (offset == 0)
+    return bits[from];
+  return (bits[from] >> offset) | (bits[from + 1] << (64 - offset));
+}
+
+/*
+  Work out the offsets that pass the filter, into bitmaps.candidates. The
+  return value is the number of words in the bitmaps that hold offsets.
+*/
+int dfa_gap_candidates(DfaGapFilterPattern const &pat_data,
+                       std::string_view sequence,
+                       DfaGapFilterBitmaps &bitmaps) {
+  auto const &column = pat_data.dfa.columns.column;
+  int columns = pat_data.dfa.columns.count;
+  int k = pat_data.k;
+  int n = sequence.length();
+  int words = n / 64 + 1;
+  // Room for the longest shift past the end. The shifts are all shorter than
+  // the longest window, and one reads the shift's whole words and one more
+  // beyond the word it is for.
+  int padded = words + (FILTER_DEPTH * k + 1) / 64 + 2;
+
+  // Where each of the pattern's characters is in the sequence.
+  bitmaps.columns.assign(columns * padded, 0);
+  std::uint64_t *where = bitmaps.columns.data();
+  for (int i = 0; i < n; i++)
+    where[column[(unsigned char)sequence[i]] * padded + i / 64] |=
+        std::uint64_t{1} << (i % 64);
+
+  // Offsets that start with pattern[0], and leave room for the rest of it.
+  int m = pat_data.dfa.m;
+  auto &candidates = bitmaps.candidates;
+  candidates.assign(where + pat_data.seeds[0] * padded,
+                    where + pat_data.seeds[0] * padded + words);
+  for (int i = n - m + 1; i < words * 64; i++)
+    if (i >= 0)
+      candidates[i / 64] &= ~(std::uint64_t{1} << (i % 64));
+
+  // Each pattern[j], j = 1 and up, somewhere from j to j * (k + 1) places on.
+  // The bitmap is spread over a window of j * k + 1 places by doubling it
+  // until it is at least half as long, and then once more for the rest. Only
+  // the words that hold offsets need spreading: those past them are 0, and
+  // stay that way, as the bits only ever move down.
+  auto &window = bitmaps.window;
+  int seeds = pat_data.seeds.size();
+  for (int j = 1; j < seeds; j++) {
+    window.assign(where + pat_data.seeds[j] * padded,
+                  where + (pat_data.seeds[j] + 1) * padded);
+    int length = j * k + 1, spread = 1;
+    for (; spread * 2 <= length; spread *= 2)
+      for (int word = 0; word < words; word++)
+        window[word] |= shifted_word(window.data(), word, spread);
+    if (length > spread)
+      for (int word = 0; word < words; word++)
+        window[word] |= shifted_word(window.data(), word, length - spread);
+
+    std::uint64_t left = 0;
+    for (int word = 0; word < words; word++) {
+      candidates[word] &= shifted_word(window.data(), word, j);
+      left |= candidates[word];
+    }
+    if (left == 0)
+      break;
+  }
+
+  return words;
+}
+
+/*
+  Run the DFA from each of the candidate offsets, with states of type State.
+  This is the inner loop of dfa_gap().
+*/
+template <typename State, typename Report>
+int dfa_gap_extend(DfaGapPattern const &pat_data, State const *dfa,
+                   std::uint64_t const *candidates, int words,
+                   std::string_view sequence, Report report) {
+  constexpr State FAIL = std::numeric_limits<State>::max();
+  // Unpack pat_data:
+  auto const &column = pat_data.columns.column;
+  int terminal = pat_data.terminal;
+
+  int matches = 0;
+  int n = sequence.length();
+
+  for (int word = 0; word < words; word++)
+    for (std::uint64_t bits = candidates[word]; bits != 0; bits &= bits - 1) {
+      int i = word * 64 + std::countr_zero(bits);
+      int state = 0;
+      for (int ch = i; ch < n; ch++) {
+        State next = dfa[state + column[(unsigned char)sequence[ch]]];
+        if (next == FAIL)
+          break;
+        state = next;
+      }
+
+      if (state == terminal) {
+        matches++;
+        report(i);
+      }
+    }
+
+  return matches;
+}
+
+/*
+  Perform the seed-and-extend DFA-Gap search. This finds the same matches as
+  dfa_gap(), in the same order.
+*/
+template <typename Report>
+int dfa_gap_filter(DfaGapFilterPattern const &pat_data,
+                   std::string_view sequence, Report report) {
+  static thread_local DfaGapFilterBitmaps bitmaps;
+  auto const &dfa = pat_data.dfa;
+  if (dfa.m == 0)
+    return 0;
+
+  int words = dfa_gap_candidates(pat_data, sequence, bitmaps);
+  std::uint64_t const *candidates = bitmaps.candidates.data();
+  switch (dfa.state_bytes) {
+  case 1:
+    return dfa_gap_extend(dfa, dfa.dfa8.data(), candidates, words, sequence,
+                          report);
+  case 2:
+    return dfa_gap_extend(dfa, dfa.dfa16.data(), candidates, words, sequence,
+                          report);
+  default:
+    return dfa_gap_extend(dfa, dfa.dfa32.data(), candidates, words, sequence,
+                          report);
+  }
+}
+
+struct DfaGapFilter {
+  typedef DfaGapFilterPattern Compiled;
+  static Compiled init(std::string_view pattern, int k) {
+    return init_dfa_gap_filter(pattern, k);
+  }
+  static int search(Compiled const &pat_data, std::string_view sequence) {
+    return dfa_gap_filter(pat_data, sequence, IgnoreMatch{});
+  }
+  template <typename Report>
+  static int search(Compiled const &pat_data, std::string_view sequence,
+                    Report report) {
+    return dfa_gap_filter(pat_data, sequence, report);
+  }
+};
+
+/*
+  The single-pass form of DFA-Gap. dfa_gap() runs the DFA afresh from every
+  offset, one character at a time. Here, the offsets are the bits of words,
+  as in Shift-Or, so that 64 of them are settled at once, and the sequence
+  is gone over once for each stage of the pattern rather than once for each
+  offset.
+
+  Each run is deterministic: having matched pattern[j] at x, it takes the
+  first pattern[j + 1] after x, as long as that comes within the next k + 1
+  characters and all of those before it are bases. Whether it goes on to
+  match the rest of the pattern depends on nothing else. So the places x from
+  which pattern[j] and the rest of the pattern match, done(j), follow from
+  done(j + 1): x is in done(j) if sequence[x] is pattern[j], and a place y of
+  done(j + 1) comes from 1 to k + 1 places after x with nothing but bases
+  other than pattern[j + 1] between them.
+
+  That is done(j + 1) moved down one place, and then spread down one place at
+  a time, up to k more times, but not past a place that holds pattern[j + 1]
+  or is not a base. done(m - 1) is where pattern[m - 1] is, and done(0) is
+  where the matches start.
+*/
+struct DfaGapScanPattern {
+  DfaColumns columns;
+  // The column of each character of the pattern.
+  std::vector<int> codes;
+  int k;
+};
+
+/*
+  Initialize the pattern given, for gaps of up to k characters.
+*/
+DfaGapScanPattern init_dfa_gap_scan(std::string_view pattern, int k) {
+  DfaColumns columns = make_columns(pattern);
+  std::vector<int> codes;
+  for (char c : pattern)
+    codes.push_back(columns.column[(unsigned char)c]);
+
+  return {columns, codes, k};
+}
+
+/*
+  One thread's bitmaps for the scan, kept from one search to the next. Each
+  has a word for every 64 offsets of the sequence and one more that is always
+  0, for the shifts to read.
+*/
+struct DfaGapScanBitmaps {
+  std::vector<std::uint64_t> columns;
+  std::vector<std::uint64_t> bases;
+  std::vector<std::uint64_t> done;
+};
+
+/*
+  Perform the single-pass DFA-Gap search. This finds the same matches as
+  dfa_gap(), in the same order.
+*/
+template <typename Report>
+int dfa_gap_scan(DfaGapScanPattern const &pat_data, std::string_view sequence,
+                 Report report) {
+  static thread_local DfaGapScanBitmaps bitmaps;
+
+  // Unpack pat_data:
+  auto const &column = pat_data.columns.column;
+  auto const &codes = pat_data.codes;
+  int k = pat_data.k;
+  int m = codes.size();
+
+  int n = sequence.length();
+  if (m == 0 || n < m)
+    return 0;
+  int words = n / 64 + 1;
+  int padded = words + 1;
+
+  // Where each of the pattern's characters is, and where the bases are.
+  bitmaps.columns.assign(pat_data.columns.count * padded, 0);
+  bitmaps.bases.assign(padded, 0);
+  std::uint64_t *where = bitmaps.columns.data();
+  std::uint64_t *bases = bitmaps.bases.data();
+  for (int i = 0; i < n; i++) {
+    int code = column[(unsigned char)sequence[i]];
+    std::uint64_t bit = std::uint64_t{1} << (i % 64);
+    where[code * padded + i / 64] |= bit;
+    if (code < ALPHABET_COUNT)
+      bases[i / 64] |= bit;
+  }
+
+  auto &done = bitmaps.done;
+  std::uint64_t const *last = where + codes[m - 1] * padded;
+  done.assign(last, last + padded);
+  for (int j = m - 2; j >= 0; j--) {
+    std::uint64_t const *after = where + codes[j + 1] * padded;
+
+    // One place down, to the places just before those of done(j + 1).
+    for (int word = 0; word < words; word++)
+      done[word] = (done[word] >> 1) | (done[word + 1] << 63);
+
+    // Then a place at a time further, from each place that is a base other
+    // than pattern[j + 1], for as long as that finds any new places.
+    for (int gap = 0; gap < k; gap++) {
+      std::uint64_t grown = 0;
+      for (int word = 0; word < words; word++) {
+        std::uint64_t from = done[word] & bases[word] & ~after[word];
+        std::uint64_t next = (done[word + 1] & bases[word + 1] &
+                              ~after[word + 1])
+                             << 63;
+        std::uint64_t spread = (from >> 1) | next;
+        grown |= spread & ~done[word];
+        done[word] |= spread;
+      }
+      if (grown == 0)
+        break;
+    }
+
+    std::uint64_t const *here = where + codes[j] * padded;
+    std::uint64_t left = 0;
+    for (int word = 0; word < words; word++) {
+      done[word] &= here[word];
+      left |= done[word];
+    }
+    if (left == 0)
+      return 0;
   }
 
+  int matches = 0;
+  for (int word = 0; word < words; word++)
+    for (std::uint64_t bits = done[word]; bits != 0; bits &= bits - 1) {
+      matches++;
+      report(word * 64 + std::countr_zero(bits));
+    }
+
   return matches;
 }
 
+struct DfaGapScan {
+  typedef DfaGapScanPattern Compiled;
+  static Compiled init(std::string_view pattern, int k) {
+    return init_dfa_gap_scan(pattern, k);
+  }
+  static int search(Compiled const &pat_data, std::string_view sequence) {
+    return dfa_gap_scan(pat_data, sequence, IgnoreMatch{});
+  }
+  template <typename Report>
+  static int search(Compiled const &pat_data, std::string_view sequence,
+                    Report report) {
+    return dfa_gap_scan(pat_data, sequence, report);
+  }
+};
+
+// Make the engines available to the combined binary as well.
+static RegisterEngine<DfaGap> registration{"dfa_gap"};
+static RegisterEngine<DfaGapScan> scan_registration{"dfa_gap_scan"};
+static RegisterEngine<DfaGapFilter> filter_registration{"dfa_gap_filter"};
+
+#ifndef MULTI_ENGINE
 /*
-  All that is done here is call the run() function with a pointer to the
-  algorithm implementation, the label for the algorithm, and the argc/argv
-  values.
+  All that is done here is call the run_approx() function with the
+  algorithm's engine, the label for the algorithm, and the argc/argv values.
 */
 int main(int argc, char *argv[]) {
-  int return_code = run_approx(&init_dfa_gap, &dfa_gap, "dfa_gap", argc, argv);
+  int return_code = run_approx<DfaGap>("dfa_gap", argc, argv);
 
   return return_code;
 }
+#endif // !MULTI_ENGINE
@@ -0,0 +1,401 @@
+/*
+  C++ implementation of a multi-pattern form of DFA-Gap, which searches for
+  all of the patterns in a single pass over each sequence.
+
+  The DFA that dfa_gap() builds for a pattern, started at an offset of the
+  sequence, matches its first character there and then, for each character
+  after that, takes the first place it comes within the next k + 1 characters
+  (as long as those before it are bases). A run of the DFA is deterministic,
+  so two patterns with the same first j + 1 characters run the same way for
+  as long as that: their DFAs can be merged, as Aho-Corasick merges the
+  patterns' prefixes, into a trie. A run at a node of the trie (the prefix
+  matched so far) waits for the character of each of the node's children,
+  independently, and moves on to a child when that character comes. The wait
+  for a child's character is called its stage.
+
+  One scan of the sequence then carries the runs from every offset along
+  together, as in the single-pass engine (dfa_gap_scan in dfa_gap.cpp): all
+  that matters about a run is its stage and the offset at which it matched
+  the stage's parent, so runs that agree on those are kept together as a
+  count. Each stage has a queue of at most k + 1 such groups while it is
+  waiting, and when its character comes, the groups that are still alive
+  (those matched no more than k + 1 characters back) arrive at the child
+  together and the queue is emptied. An arrival at a node where patterns end
+  is a match of each of them, for every run in the group.
+
+  Unlike the single-pattern trie of Aho-Corasick, there are no failure links:
+  a new run is started at every offset anyway, and the runs that end are just
+  dropped.
+*/
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "run.hpp"
+
+// The value of a missing node, column or group.
+constexpr int NONE = -1;
+
+/*
+  The columns of the trie, one for each character that the patterns have. The
+  four bases have the first four, and any other characters get one each after
+  those; `column` is NONE for the rest.
+*/
+constexpr int BASES_COUNT = 4;
+static const std::array<char, BASES_COUNT> BASES = {'A', 'C', 'G', 'T'};
+
+/*
+  The pre-processed form of the patterns, as used by dfa_gap_multi(). The
+  nodes of the trie are numbered breadth-first from the root (0), so that the
+  children of node v are the nodes from first_child[v] up to (but not
+  including) first_child[v + 1]. label[v] is the column of the character on
+  the edge to v, and the patterns that end at v are patterns[offsets[v]] up
+  to patterns[offsets[v + 1]].
+*/
+struct DfaGapMultiPatterns {
+  int pattern_count;
+  int k;
+  std::array<int, 256> column;
+  int columns;
+  std::vector<int> label;
+  std::vector<int> first_child;
+  std::vector<int> offsets;
+  std::vector<int> patterns;
+  // The child of the root for each column, where the runs start.
+  std::vector<int> start;
+};
+
+/*
+  Initialize the patterns given, for gaps of up to k characters.
+*/
+DfaGapMultiPatterns
+init_dfa_gap_multi(std::vector<std::string_view> const &patterns_data,
+                   int k) {
+  DfaGapMultiPatterns pat_data;
+  pat_data.pattern_count = patterns_data.size();
+  pat_data.k = k;
+
+  auto &column = pat_data.column;
+  column.fill(NONE);
+  for (int n = 0; n < BASES_COUNT; n++)
+    column[(unsigned char)BASES[n]] = n;
+  int columns = BASES_COUNT;
+  for (auto const &pattern : patterns_data)
+    for (char c : pattern)
+      if (column[(unsigned char)c] == NONE)
+        column[(unsigned char)c] = columns++;
+  pat_data.columns = columns;
+
+  // Enter the patterns into a trie with a row of `columns` children for each
+  // node, in the order the nodes are made.
+  std::vector<int> children(columns, NONE);
+  std::vector<int> ends(pat_data.pattern_count);
+  int nodes = 1;
+  for (int idx = 0; idx < pat_data.pattern_count; idx++) {
+    int node = 0;
+    for (char c : patterns_data[idx]) {
+      int next = children[node * columns + column[(unsigned char)c]];
+      if (next == NONE) {
+        next = nodes++;
+        children[node * columns + column[(unsigned char)c]] = next;
+        children.resize(nodes * columns, NONE);
+      }
+      node = next;
+    }
+    ends[idx] = node;
+  }
+
+  // Number the nodes again, breadth-first. `order` lists the old numbers in
+  // the new order, and `number` maps the old numbers to the new.
+  std::vector<int> order{0}, number(nodes);
+  auto &label = pat_data.label;
+  auto &first_child = pat_data.first_child;
+  label.push_back(NONE);
+  for (std::size_t idx = 0; idx < order.size(); idx++) {
+    number[order[idx]] = idx;
+    first_child.push_back(order.size());
+    for (int code = 0; code < columns; code++) {
+      int child = children[order[idx] * columns + code];
+      if (child != NONE) {
+        order.push_back(child);
+        label.push_back(code);
+      }
+    }
+  }
+  first_child.push_back(nodes);
+
+  pat_data.start.assign(columns, NONE);
+  for (int child = first_child[0]; child < first_child[1]; child++)
+    pat_data.start[label[child]] = child;
+
+  // The output function, in compressed sparse row form.
+  auto &offsets = pat_data.offsets;
+  offsets.assign(nodes + 1, 0);
+  for (int end : ends)
+    offsets[number[end] + 1]++;
+  for (int node = 0; node < nodes; node++)
+    offsets[node + 1] += offsets[node];
+  pat_data.patterns.resize(pat_data.pattern_count);
+  std::vector<int> next = offsets;
+  for (int idx = 0; idx < pat_data.pattern_count; idx++)
+    pat_data.patterns[next[number[ends[idx]]]++] = idx;
+
+  return pat_data;
+}
+
+/*
+  One thread's working space for the search. Only the stages that have runs
+  waiting have a queue, which is a block of k + 1 slots taken from a pool
+  (`queue` is NONE for the others). The waiting stages are listed by their
+  label, so that a character finds the ones it moves on.
+
+  Between searches every stage is empty and every list is clear, so the space
+  can be kept from one sequence to the next, and for another set of patterns.
+  Once it has grown to fit, a search allocates nothing.
+*/
+struct DfaGapMultiQueues {
+  // A group of runs that have all matched at the same offset. `group` is
+  // only used when reporting positions (see dfa_gap_multi()).
+  struct Slot {
+    int offset;
+    int count;
+    int group;
+  };
+  struct Arrival {
+    int node;
+    int count;
+    int group;
+  };
+
+  std::vector<int> queue;
+  std::vector<int> head, length;
+  std::vector<Slot> slots;
+  std::vector<int> free_queues;
+  std::vector<std::vector<int>> waiting;
+  std::vector<int> moving;
+  std::vector<Arrival> arrivals;
+  // The joined groups, and the stack for walking them, when reporting
+  // positions. These are cleared for each search.
+  std::vector<std::pair<int, int>> joins;
+  std::vector<int> stack;
+
+  void reset(DfaGapMultiPatterns const &pat_data) {
+    if (queue.size() < pat_data.label.size())
+      queue.resize(pat_data.label.size(), NONE);
+    if (waiting.size() < (std::size_t)pat_data.columns)
+      waiting.resize(pat_data.columns);
+    joins.clear();
+    stack.clear();
+    // Queues are made again for a different k.
+    if (!head.empty() && slots.size() != head.size() * (pat_data.k + 1)) {
+      head.clear();
+      length.clear();
+      slots.clear();
+      free_queues.clear();
+    }
+  }
+
+  // Add a group to the end of the stage's queue, first dropping those at the
+  // front whose gap is now too long.
+  void push(DfaGapMultiPatterns const &pat_data, int stage, int offset,
+            int count, int group) {
+    int size = pat_data.k + 1;
+    int block = queue[stage];
+    if (block == NONE) {
+      if (free_queues.empty()) {
+        free_queues.push_back(head.size());
+        head.push_back(0);
+        length.push_back(0);
+        slots.resize(slots.size() + size);
+      }
+      block = free_queues.back();
+      free_queues.pop_back();
+      queue[stage] = block;
+      head[block] = 0;
+      length[block] = 0;
+      waiting[pat_data.label[stage]].push_back(stage);
+    } else {
+      drop(block, size, offset - pat_data.k);
+    }
+    slots[block * size + (head[block] + length[block]++) % size] = {
+        offset, count, group};
+  }
+
+  // Drop the groups at the front of a queue that matched before `oldest`.
+  void drop(int block, int size, int oldest) {
+    while (length[block] > 0 && slots[block * size + head[block]].offset <
+                                    oldest) {
+      head[block] = (head[block] + 1) % size;
+      length[block]--;
+    }
+  }
+
+  // Give a stage's queue back to the pool.
+  void release(int stage) {
+    free_queues.push_back(queue[stage]);
+    queue[stage] = NONE;
+  }
+};
+
+/*
+  Perform the multi-pattern DFA-Gap search, adding the number of matches of
+  each pattern to `matches`. `report` is called with the number of the
+  pattern and the offset of each match, in the order that they end.
+
+  To report the positions, each group keeps the starting offsets of its runs
+  as a binary tree: a group below n is a leaf, the run that started at that
+  offset, and one from n up is a join of two others, made when groups arrive
+  at a node together. The groups in a queue are for different runs, so each
+  tree is walked in time linear in its leaves.
+*/
+template <typename Report>
+void dfa_gap_multi(DfaGapMultiPatterns const &pat_data,
+                   std::string_view sequence, std::vector<int> &matches,
+                   Report report) {
+  constexpr bool positions = !std::is_same_v<Report, IgnoreMatch>;
+  static thread_local DfaGapMultiQueues scratch;
+  scratch.reset(pat_data);
+
+  // Unpack pat_data:
+  int k = pat_data.k;
+  int size = k + 1;
+  auto const &column = pat_data.column;
+  int const *first_child = pat_data.first_child.data();
+  int const *offsets = pat_data.offsets.data();
+  int const *patterns = pat_data.patterns.data();
+  int const *start = pat_data.start.data();
+  auto &waiting = scratch.waiting;
+  auto &moving = scratch.moving;
+  auto &arrivals = scratch.arrivals;
+  auto &joins = scratch.joins;
+  auto &stack = scratch.stack;
+
+  int n = sequence.length();
+  auto join = [&](int left, int right) {
+    joins.emplace_back(left, right);
+    return n + (int)joins.size() - 1;
+  };
+
+  for (int i = 0; i < n; i++) {
+    int code = column[(unsigned char)sequence[i]];
+
+    // The stages that this character moves on, all of whose queues are
+    // emptied before any of the arrivals are added to the next stages.
+    arrivals.clear();
+    if (code != NONE) {
+      moving.clear();
+      std::swap(moving, waiting[code]);
+      for (int stage : moving) {
+        int block = scratch.queue[stage];
+        scratch.drop(block, size, i - k - 1);
+        int count = 0, group = NONE;
+        for (int idx = 0; idx < scratch.length[block]; idx++) {
+          auto const &slot =
+              scratch.slots[block * size + (scratch.head[block] + idx) % size];
+          count += slot.count;
+          if constexpr (positions)
+            group = group == NONE ? slot.group : join(group, slot.group);
+        }
+        scratch.release(stage);
+        if (count != 0)
+          arrivals.push_back({stage, count, group});
+      }
+      if (start[code] != NONE)
+        arrivals.push_back({start[code], 1, i});
+    }
+
+    for (auto const &arrival : arrivals) {
+      int node = arrival.node;
+      for (int idx = offsets[node]; idx < offsets[node + 1]; idx++) {
+        matches[patterns[idx]] += arrival.count;
+        if constexpr (positions) {
+          stack.push_back(arrival.group);
+          while (!stack.empty()) {
+            int group = stack.back();
+            stack.pop_back();
+            if (group < n) {
+              report(patterns[idx], group);
+            } else {
+              stack.push_back(joins[group - n].second);
+              stack.push_back(joins[group - n].first);
+            }
+          }
+        }
+      }
+      for (int child = first_child[node]; child < first_child[node + 1];
+           child++)
+        scratch.push(pat_data, child, i, arrival.count, arrival.group);
+    }
+
+    // Any other character ends every run that it did not move on.
+    if (code < BASES_COUNT && code != NONE)
+      continue;
+    for (auto &stages : waiting) {
+      std::size_t kept = 0;
+      for (int stage : stages) {
+        int block = scratch.queue[stage];
+        scratch.drop(block, size, i);
+        if (scratch.length[block] == 0)
+          scratch.release(stage);
+        else
+          stages[kept++] = stage;
+      }
+      stages.resize(kept);
+    }
+  }
+
+  // Leave the working space empty for the next search.
+  for (auto &stages : waiting) {
+    for (int stage : stages)
+      scratch.release(stage);
+    stages.clear();
+  }
+}
+
+std::vector<int> dfa_gap_multi(DfaGapMultiPatterns const &pat_data,
+                               std::string_view sequence) {
+  std::vector<int> matches(pat_data.pattern_count, 0);
+  dfa_gap_multi(pat_data, sequence, matches, IgnoreMatch{});
+
+  return matches;
+}
+
+/*
+  The engine that hands the functions above to the runner.
+*/
+struct DfaGapMulti {
+  typedef DfaGapMultiPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns, int k) {
+    return init_dfa_gap_multi(patterns, k);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return dfa_gap_multi(pat_data, sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    std::vector<int> matches(pat_data.pattern_count, 0);
+    dfa_gap_multi(pat_data, sequence, matches, report);
+  }
+};
+
+// Make the engine available to the combined binary as well.
+static RegisterEngine<DfaGapMulti> registration{"dfa_gap_multi"};
+
+#ifndef MULTI_ENGINE
+/*
+  All that is done here is call the run_multi_approx() function with the
+  algorithm's engine, the label for the algorithm, and the argc/argv values.
+*/
+int main(int argc, char *argv[]) {
+  int return_code = run_multi_approx<DfaGapMulti>("dfa_gap_multi", argc, argv);
+
+  return return_code;
+}
+#endif // !MULTI_ENGINE
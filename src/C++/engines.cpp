@@ -0,0 +1,93 @@
+/*
+  The combined benchmark program. This is linked with every engine, and runs
+  a list of them (chosen by name on the command line) over the same data,
+  which is loaded just the once. Comparing engines this way does not pay for
+  the start-up and loading again for each one, and every engine finds the data
+  in the same state.
+
+  The engines' results are written one after the other, as separate YAML
+  documents. With -o, each engine writes the positions file afresh, so it
+  ends up holding those of the last engine.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "run.hpp"
+
+/*
+  Look up the comma-separated list of engine names in the registry. Unknown
+  names are an error, as is a mix of exact and approximate engines (which
+  would need different answers files).
+*/
+std::vector<RegisteredEngine const *> select_engines(std::string const &list) {
+  std::vector<RegisteredEngine const *> engines;
+  std::istringstream names{list};
+  std::string name;
+
+  while (std::getline(names, name, ',')) {
+    RegisteredEngine const *found = nullptr;
+    for (auto const &engine : engine_registry())
+      if (engine.name == name)
+        found = &engine;
+
+    if (found == nullptr) {
+      std::ostringstream error;
+      error << "Unknown engine \"" << name << "\"; the engines are:";
+      for (auto const &engine : engine_registry())
+        error << " " << engine.name;
+      throw std::runtime_error{error.str()};
+    }
+    if (!engines.empty() && found->approx != engines.front()->approx)
+      throw std::runtime_error{
+          "Exact and approximate engines cannot be run together"};
+    engines.push_back(found);
+  }
+
+  if (engines.empty())
+    throw std::runtime_error{"No engines given"};
+
+  return engines;
+}
+
+/*
+  The arguments are those of the separate programs, preceded by the list of
+  engines. The k argument is only there for approximate engines.
+*/
+int main(int argc, char *argv[]) {
+  RunOptions options;
+  int arg = parse_options(
+      argc, argv, true, 3, 5,
+      "<engine>[,<engine>...] [ <k> ] <sequences> <patterns> [ <answers> ]",
+      options);
+
+  auto engines = select_engines(argv[arg++]);
+  bool approx = engines.front()->approx;
+  int k = approx ? std::stoi(argv[arg++]) : -1;
+  int remaining = argc - arg;
+  if (remaining < 2 || remaining > 3)
+    throw std::runtime_error{approx ? "Expected <k> <sequences> <patterns> "
+                                      "[ <answers> ] after the engines"
+                                    : "Expected <sequences> <patterns> "
+                                      "[ <answers> ] after the engines"};
+
+  double start_time = get_time();
+  Experiment data =
+      load_experiment(argv[arg], argv[arg + 1],
+                      remaining == 3 ? argv[arg + 2] : nullptr, k,
+                      options.all_k);
+  double load_time = get_time() - start_time;
+
+  int return_code = 0;
+  for (std::size_t idx = 0; idx < engines.size(); idx++) {
+    if (idx > 0)
+      std::cout << "---\n";
+    return_code +=
+        engines[idx]->run(engines[idx]->name, data, options, load_time);
+  }
+
+  return return_code;
+}
@@ -0,0 +1,352 @@
+/*
+  The incremental Aho-Corasick machine (see incremental.hpp), and its engine.
+
+  The engine only builds the dictionary and searches it, as the other
+  engines do; the changes to a dictionary are timed by the update program
+  (update.cpp).
+*/
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "incremental.hpp"
+#include "run.hpp"
+
+/*
+  Throw an exception unless the pattern can be entered: it has to have at
+  least one character, and only the four bases.
+*/
+static void check_pattern(std::string_view pattern) {
+  bool ok = !pattern.empty();
+  for (char c : pattern)
+    if (c != 'A' && c != 'C' && c != 'G' && c != 'T')
+      ok = false;
+
+  if (!ok) {
+    std::ostringstream error;
+    error << "aho_corasick_incremental: pattern \"" << pattern
+          << "\" is empty or has a character other than A, C, G and T";
+    throw std::runtime_error{error.str()};
+  }
+}
+
+/*
+  Build the machine for the initial dictionary. This is done as it is by
+  init_aho_corasick(): the patterns are all entered into the trie first, and
+  then the failure and output links are made breadth-first.
+*/
+IncrementalAhoCorasick::IncrementalAhoCorasick(
+    std::vector<std::string_view> const &patterns) {
+  states.push_back({{NONE, NONE, NONE, NONE},
+                    NONE,
+                    NONE,
+                    NONE,
+                    NONE,
+                    NONE,
+                    NONE,
+                    NONE,
+                    NONE});
+
+  for (auto const &pattern : patterns) {
+    check_pattern(pattern);
+    int state = 0;
+    for (char c : pattern) {
+      int code = base_code(c);
+      if (states[state].child[code] == NONE)
+        new_state(state, code);
+      state = states[state].child[code];
+    }
+
+    next_pattern.push_back(states[state].first_pattern);
+    states[state].first_pattern = lengths.size();
+    lengths.push_back(pattern.length());
+    pattern_state.push_back(state);
+  }
+
+  // A state's parent is always before it in breadth-first order, and its
+  // failure state (being shallower) is always linked before it is.
+  std::vector<int> order;
+  for (int code = 0; code < 4; code++)
+    if (states[0].child[code] != NONE)
+      order.push_back(states[0].child[code]);
+  for (std::size_t idx = 0; idx < order.size(); idx++) {
+    State const &state = states[order[idx]];
+    for (int code = 0; code < 4; code++)
+      if (state.child[code] != NONE)
+        order.push_back(state.child[code]);
+  }
+
+  for (int state : order) {
+    int fail = find_fail(states[state].parent, states[state].code);
+    link_fail(state, fail);
+    states[state].output = matched(fail);
+  }
+  cost = states.size();
+}
+
+/*
+  Add a pattern, and return its number. The states it needs that are not
+  there yet are added one at a time, each being linked into the machine as it
+  is made (see adopt()).
+*/
+int IncrementalAhoCorasick::add(std::string_view pattern) {
+  check_pattern(pattern);
+  cost = 0;
+
+  int state = 0;
+  for (char c : pattern) {
+    int code = base_code(c);
+    int next = states[state].child[code];
+    if (next == NONE) {
+      next = new_state(state, code);
+      int fail = find_fail(state, code);
+      link_fail(next, fail);
+      states[next].output = matched(fail);
+      cost++;
+      adopt(next);
+    }
+    state = next;
+  }
+
+  // If no pattern ended here before, the states that fail to this one now
+  // have it as their output.
+  int idx = lengths.size();
+  bool was_end = is_end(state);
+  next_pattern.push_back(states[state].first_pattern);
+  states[state].first_pattern = idx;
+  lengths.push_back(pattern.length());
+  pattern_state.push_back(state);
+  if (!was_end)
+    refresh_failing(state);
+
+  return idx;
+}
+
+/*
+  Remove a pattern. If it was the last to end at its state, the states whose
+  output that was are given the next one down the chain; and then the states
+  at the end of the pattern that now lead to no pattern at all are taken out
+  of the trie, from the deepest up.
+*/
+void IncrementalAhoCorasick::remove(int pattern) {
+  if (pattern < 0 || pattern >= pattern_count() ||
+      pattern_state[pattern] == NONE) {
+    std::ostringstream error;
+    error << "aho_corasick_incremental: there is no pattern " << pattern
+          << " to remove";
+    throw std::runtime_error{error.str()};
+  }
+  cost = 0;
+
+  int state = pattern_state[pattern];
+  int *link = &states[state].first_pattern;
+  while (*link != pattern)
+    link = &next_pattern[*link];
+  *link = next_pattern[pattern];
+  lengths[pattern] = 0;
+  pattern_state[pattern] = NONE;
+  if (is_end(state))
+    return;
+  refresh_failing(state);
+
+  auto is_leaf = [&](int leaf) {
+    for (int child : states[leaf].child)
+      if (child != NONE)
+        return false;
+    return true;
+  };
+  while (state != 0 && !is_end(state) && is_leaf(state)) {
+    int parent = states[state].parent;
+    int fail = states[state].fail;
+    states[parent].child[states[state].code] = NONE;
+
+    // The states that failed to this one fail to its failure state instead,
+    // which is the longest of their suffixes left. Their outputs stay as
+    // they were, as no pattern ended here.
+    while (states[state].first_failing != NONE) {
+      int failing = states[state].first_failing;
+      unlink_fail(failing);
+      link_fail(failing, fail);
+      cost++;
+    }
+    unlink_fail(state);
+    free_states.push_back(state);
+    cost++;
+
+    state = parent;
+  }
+}
+
+/*
+  The count-only search: the number of matches for each pattern number.
+*/
+std::vector<int>
+IncrementalAhoCorasick::search(std::string_view sequence) const {
+  std::vector<int> matches(pattern_count(), 0);
+  search(sequence, [&](int pattern, std::size_t) { matches[pattern]++; });
+
+  return matches;
+}
+
+/*
+  Make a new state as the child of `parent` on `code`, reusing the number of
+  a removed state if there is one. It is not linked to anything else yet.
+*/
+int IncrementalAhoCorasick::new_state(int parent, int code) {
+  int state;
+  if (free_states.empty()) {
+    state = states.size();
+    states.emplace_back();
+  } else {
+    state = free_states.back();
+    free_states.pop_back();
+  }
+
+  states[state] = {{NONE, NONE, NONE, NONE},
+                   parent,
+                   code,
+                   NONE,
+                   NONE,
+                   NONE,
+                   NONE,
+                   NONE,
+                   NONE};
+  states[parent].child[code] = state;
+
+  return state;
+}
+
+/*
+  The failure state for the child of `parent` on `code`: the child on `code`
+  of the first state on the parent's failure chain that has one.
+*/
+int IncrementalAhoCorasick::find_fail(int parent, int code) const {
+  if (parent == 0)
+    return 0;
+
+  for (int state = states[parent].fail;; state = states[state].fail) {
+    int next = states[state].child[code];
+    if (next != NONE)
+      return next;
+    if (state == 0)
+      return 0;
+  }
+}
+
+void IncrementalAhoCorasick::link_fail(int state, int fail) {
+  State &to = states[fail];
+  states[state].fail = fail;
+  states[state].prev_failing = NONE;
+  states[state].next_failing = to.first_failing;
+  if (to.first_failing != NONE)
+    states[to.first_failing].prev_failing = state;
+  to.first_failing = state;
+}
+
+void IncrementalAhoCorasick::unlink_fail(int state) {
+  State &from = states[state];
+  if (from.prev_failing == NONE)
+    states[from.fail].first_failing = from.next_failing;
+  else
+    states[from.prev_failing].next_failing = from.next_failing;
+  if (from.next_failing != NONE)
+    states[from.next_failing].prev_failing = from.prev_failing;
+  from.fail = NONE;
+}
+
+/*
+  Work out the output of `state` again from its failure state. If that
+  changed, and no pattern ends at the state, the states that fail to it have
+  the same output as it does and are done in turn.
+*/
+void IncrementalAhoCorasick::refresh_outputs(int state) {
+  std::vector<int> stack{state};
+
+  while (!stack.empty()) {
+    int next = stack.back();
+    stack.pop_back();
+    cost++;
+
+    int output = matched(states[next].fail);
+    if (output == states[next].output)
+      continue;
+    states[next].output = output;
+    if (is_end(next))
+      continue;
+    for (int failing = states[next].first_failing; failing != NONE;
+         failing = states[failing].next_failing)
+      stack.push_back(failing);
+  }
+}
+
+/*
+  Work out the outputs again for the states that fail to `state`, after a
+  pattern has started or stopped ending at it.
+*/
+void IncrementalAhoCorasick::refresh_failing(int state) {
+  for (int failing = states[state].first_failing; failing != NONE;
+       failing = states[failing].next_failing)
+    refresh_outputs(failing);
+}
+
+/*
+  Repair the failure links for a new state. The states whose longest suffix
+  in the trie is now the new state are the children, on its code, of the
+  states below its parent in the failure tree: for each path down that tree,
+  the child of the first state on it to have one. (Any further down fail to
+  that child, or to something longer.) The parent's subtree is searched as
+  it was before anything was moved, which is the failure tree the rule above
+  is about.
+*/
+void IncrementalAhoCorasick::adopt(int state) {
+  int parent = states[state].parent;
+  int code = states[state].code;
+  std::vector<int> stack;
+  for (int failing = states[parent].first_failing; failing != NONE;
+       failing = states[failing].next_failing)
+    stack.push_back(failing);
+
+  while (!stack.empty()) {
+    int next = stack.back();
+    stack.pop_back();
+    cost++;
+    if (next == state)
+      continue;
+
+    int child = states[next].child[code];
+    if (child != NONE) {
+      unlink_fail(child);
+      link_fail(child, state);
+      refresh_outputs(child);
+      continue;
+    }
+    for (int failing = states[next].first_failing; failing != NONE;
+         failing = states[failing].next_failing)
+      stack.push_back(failing);
+  }
+}
+
+/*
+  The engine, for checking the machine against the others.
+*/
+struct AhoCorasickIncremental {
+  typedef IncrementalAhoCorasick Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return IncrementalAhoCorasick{patterns};
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return pat_data.search(sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    pat_data.search(sequence, report);
+  }
+};
+
+static RegisterEngine<AhoCorasickIncremental> registration{
+    "aho_corasick_incremental"};
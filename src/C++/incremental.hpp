@@ -0,0 +1,140 @@
+/*
+  Header file for the incremental Aho-Corasick machine, whose dictionary can
+  have patterns added to it and removed from it after it is built.
+*/
+
+#ifndef _INCREMENTAL_HPP
+#define _INCREMENTAL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/*
+  An Aho-Corasick machine over the four bases, kept in a form that can be
+  changed a pattern at a time. Adding or removing a pattern repairs only the
+  failure and output links that the change affects, rather than building the
+  machine again.
+
+  To find those links, each state keeps a list of the states that fail to it
+  (the children of the state in the failure tree). The output link of a
+  state is the nearest state on its failure chain at which a pattern ends, so
+  the search follows those rather than walking the whole chain.
+
+  Patterns are numbered in the order they were added, from 0, including those
+  in the initial dictionary; the number of a removed pattern is not used
+  again, and its count is always 0.
+*/
+class IncrementalAhoCorasick {
+public:
+  explicit IncrementalAhoCorasick(
+      std::vector<std::string_view> const &patterns);
+
+  int add(std::string_view pattern);
+  void remove(int pattern);
+
+  // The number of patterns numbered so far, including those removed.
+  int pattern_count() const { return lengths.size(); }
+  // The number of states, of which the start state is one.
+  std::size_t size() const { return states.size() - free_states.size(); }
+  // The number of states whose links were looked at by the last add() or
+  // remove(), or by the initial build. This is the cost of the change, in
+  // the same terms as a build of the whole machine.
+  std::size_t last_cost() const { return cost; }
+
+  /*
+    Search the sequence, calling `report` with the number of the pattern and
+    the offset of each match. A character that is not one of the bases sends
+    the machine back to the start state.
+  */
+  template <typename Report>
+  void search(std::string_view sequence, Report report) const {
+    int state = 0;
+    int n = sequence.length();
+
+    for (int i = 0; i < n; i++) {
+      int code = base_code(sequence[i]);
+      if (code < 0) {
+        state = 0;
+        continue;
+      }
+
+      while (state != 0 && states[state].child[code] == NONE)
+        state = states[state].fail;
+      state = states[state].child[code];
+      if (state == NONE)
+        state = 0;
+
+      for (int match = matched(state); match != NONE;
+           match = states[match].output)
+        for (int idx = states[match].first_pattern; idx != NONE;
+             idx = next_pattern[idx])
+          report(idx, i + 1 - lengths[idx]);
+    }
+  }
+
+  std::vector<int> search(std::string_view sequence) const;
+
+  // The value of a missing state or pattern.
+  static constexpr int NONE = -1;
+
+private:
+  struct State {
+    std::array<int, 4> child;
+    int parent;
+    int code;
+    int fail;
+    // The nearest state on the failure chain (not counting this one) at
+    // which a pattern ends.
+    int output;
+    // The patterns that end here, chained through next_pattern.
+    int first_pattern;
+    // The states that fail to this one, as a doubly-linked list.
+    int first_failing;
+    int next_failing;
+    int prev_failing;
+  };
+
+  // The code of a base (0 to 3), or -1 for any other character.
+  static int base_code(char c) {
+    switch (c) {
+    case 'A':
+      return 0;
+    case 'C':
+      return 1;
+    case 'G':
+      return 2;
+    case 'T':
+      return 3;
+    default:
+      return -1;
+    }
+  }
+  bool is_end(int state) const {
+    return states[state].first_pattern != NONE;
+  }
+  // The first state to report from, on entering `state`.
+  int matched(int state) const {
+    return is_end(state) ? state : states[state].output;
+  }
+
+  int new_state(int parent, int code);
+  int find_fail(int parent, int code) const;
+  void link_fail(int state, int fail);
+  void unlink_fail(int state);
+  void refresh_outputs(int state);
+  void refresh_failing(int state);
+  void adopt(int state);
+
+  std::vector<State> states;
+  std::vector<int> free_states;
+  std::vector<int> next_pattern;
+  // The length of each pattern (0 once removed) and the state it ends at.
+  std::vector<int> lengths;
+  std::vector<int> pattern_state;
+  std::size_t cost = 0;
+};
+
+#endif // !_INCREMENTAL_HPP
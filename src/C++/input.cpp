@@ -3,10 +3,19 @@
   return viable data structures.
 */
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
 #include "input.hpp"
@@ -73,6 +82,269 @@ std::vector<std::string> read_patterns(std::string fname) {
   return read_sequences(fname);
 }
 
+/*
+  Map the whole of the given file read-only into memory, storing its size in
+  `length`. Throws on any error, including an empty file (which cannot be
+  mapped).
+*/
+static void *map_file(std::string const &fname, std::size_t &length) {
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::ostringstream error;
+    error << "Error opening " << fname << " for reading";
+    throw std::runtime_error{error.str()};
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    std::ostringstream error;
+    error << fname << ": unable to determine file size, or file is empty";
+    throw std::runtime_error{error.str()};
+  }
+  length = st.st_size;
+
+  void *base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The descriptor is not needed once the mapping exists.
+  close(fd);
+  if (base == MAP_FAILED) {
+    std::ostringstream error;
+    error << "Error mapping " << fname << " into memory";
+    throw std::runtime_error{error.str()};
+  }
+  // The data is read front-to-back exactly once while building the tables, and
+  // then randomly-ish by the experiments.
+  madvise(base, length, MADV_WILLNEED);
+
+  return base;
+}
+
+/*
+  Map the given file into memory and build the table of line views. The header
+  line is parsed the same way as read_header() does it, and the number of data
+  lines is checked against it just as read_sequences() does.
+*/
+SequenceData::SequenceData(std::string const &fname) {
+  base = map_file(fname, length);
+  std::string_view data{static_cast<char const *>(base), length};
+
+  // The header line. Only the first number (the line count) is used.
+  std::size_t eol = data.find('\n');
+  std::istringstream header{std::string{data.substr(0, eol)}};
+  unsigned int num_lines = 0;
+  header >> num_lines;
+  data.remove_prefix(eol == std::string_view::npos ? data.size() : eol + 1);
+
+  // Split the rest on newlines. A final line without a newline is still a
+  // line, but a trailing newline does not start a new (empty) one. This is the
+  // same behavior as std::getline.
+  lines.reserve(num_lines);
+  while (!data.empty()) {
+    eol = data.find('\n');
+    if (eol == std::string_view::npos) {
+      lines.push_back(data);
+      break;
+    }
+    lines.push_back(data.substr(0, eol));
+    data.remove_prefix(eol + 1);
+  }
+
+  if (lines.size() != num_lines) {
+    munmap(base, length);
+    base = nullptr;
+    std::ostringstream error;
+    error << fname << ": wrong number of lines read";
+    throw std::runtime_error{error.str()};
+  }
+}
+
+/*
+  Expand a packed file into text form. All of the records are decoded into one
+  heap buffer, so the result has the same single-buffer layout as a mapped
+  text file even though the mapping itself is not kept. No engine searches
+  the packed form yet, so in memory a packed file takes as much room as the
+  text one; the format only saves space on disk and I/O when loading.
+*/
+SequenceData::SequenceData(PackedSequences const &packed) {
+  std::size_t total = 0;
+  for (std::size_t idx = 0; idx < packed.size(); idx++)
+    total += packed.length(idx);
+  buffer.resize(total);
+
+  lines.reserve(packed.size());
+  char *out = buffer.data();
+  for (std::size_t idx = 0; idx < packed.size(); idx++) {
+    packed.unpack(idx, out);
+    lines.emplace_back(out, packed.length(idx));
+    out += packed.length(idx);
+  }
+}
+
+SequenceData::SequenceData(SequenceData &&other) noexcept
+    : base{std::exchange(other.base, nullptr)},
+      length{std::exchange(other.length, 0)}, buffer{std::move(other.buffer)},
+      lines{std::move(other.lines)} {}
+
+SequenceData &SequenceData::operator=(SequenceData &&other) noexcept {
+  if (this != &other) {
+    if (base != nullptr)
+      munmap(base, length);
+    base = std::exchange(other.base, nullptr);
+    length = std::exchange(other.length, 0);
+    buffer = std::move(other.buffer);
+    lines = std::move(other.lines);
+  }
+
+  return *this;
+}
+
+SequenceData::~SequenceData() {
+  if (base != nullptr)
+    munmap(base, length);
+}
+
+/*
+  Map a packed file and locate its index, length table and base data. The
+  layout is documented in util/pack_sequences.py, which writes these files.
+  The header fields are read in host byte order, which is fine for the x86
+  machines the experiments run on.
+*/
+PackedSequences::PackedSequences(std::string const &fname) {
+  base = map_file(fname, map_length);
+  auto const *bytes = static_cast<std::uint8_t const *>(base);
+
+  // Check the magic and version, then pull the counts out of the header.
+  auto fail = [&](char const *what) {
+    munmap(base, map_length);
+    base = nullptr;
+    std::ostringstream error;
+    error << fname << ": " << what;
+    throw std::runtime_error{error.str()};
+  };
+  if (map_length < PACKED_HEADER_SIZE ||
+      std::memcmp(bytes, PACKED_MAGIC, 4) != 0)
+    fail("not a packed sequence file");
+  std::uint32_t version;
+  std::memcpy(&version, bytes + 4, sizeof version);
+  if (version != PACKED_VERSION)
+    fail("unsupported packed format version");
+  std::memcpy(&count, bytes + 8, sizeof count);
+  std::memcpy(&max_len, bytes + 16, sizeof max_len);
+
+  // The index and length table follow the header directly, and the base data
+  // starts at the next 8-byte boundary after them. The count comes from the
+  // file, so it is checked against the file's size before anything is
+  // multiplied by it.
+  constexpr std::size_t record_bytes =
+      sizeof(std::uint64_t) + sizeof(std::uint32_t);
+  if (count > (map_length - PACKED_HEADER_SIZE) / record_bytes)
+    fail("truncated record index");
+  std::size_t tables = PACKED_HEADER_SIZE + count * record_bytes;
+  std::size_t data_start = (tables + 7) & ~std::size_t{7};
+  if (map_length < data_start)
+    fail("truncated record index");
+  offsets = reinterpret_cast<std::uint64_t const *>(bytes + PACKED_HEADER_SIZE);
+  lengths = reinterpret_cast<std::uint32_t const *>(offsets + count);
+  bases = bytes + data_start;
+
+  // Make sure no record claims data past the end of the file. The offsets are
+  // arbitrary 64-bit values, so the comparison is arranged not to overflow.
+  std::size_t data_length = map_length - data_start;
+  for (std::size_t idx = 0; idx < count; idx++)
+    if (offsets[idx] > data_length ||
+        (lengths[idx] + std::size_t{3}) / 4 > data_length - offsets[idx])
+      fail("record extends past the end of the file");
+}
+
+PackedSequences::PackedSequences(PackedSequences &&other) noexcept
+    : base{std::exchange(other.base, nullptr)},
+      map_length{std::exchange(other.map_length, 0)},
+      count{std::exchange(other.count, 0)}, max_len{other.max_len},
+      offsets{other.offsets}, lengths{other.lengths}, bases{other.bases} {}
+
+PackedSequences &PackedSequences::operator=(PackedSequences &&other) noexcept {
+  if (this != &other) {
+    if (base != nullptr)
+      munmap(base, map_length);
+    base = std::exchange(other.base, nullptr);
+    map_length = std::exchange(other.map_length, 0);
+    count = std::exchange(other.count, 0);
+    max_len = other.max_len;
+    offsets = other.offsets;
+    lengths = other.lengths;
+    bases = other.bases;
+  }
+
+  return *this;
+}
+
+PackedSequences::~PackedSequences() {
+  if (base != nullptr)
+    munmap(base, map_length);
+}
+
+/*
+  Decode record `idx` into `out`, which must have room for length(idx)
+  characters. A table maps each packed byte to its four characters, so the
+  bulk of a record is decoded a byte (four bases) at a time.
+*/
+void PackedSequences::unpack(std::size_t idx, char *out) const {
+  static auto const decode = [] {
+    std::array<std::array<char, 4>, 256> table{};
+    for (int byte = 0; byte < 256; byte++)
+      for (int shift = 0; shift < 4; shift++)
+        table[byte][shift] = PACKED_ALPHABET[(byte >> (2 * shift)) & 3];
+    return table;
+  }();
+
+  std::uint8_t const *in = packed(idx);
+  std::size_t n = lengths[idx];
+  std::size_t whole = n / 4;
+  for (std::size_t i = 0; i < whole; i++, out += 4)
+    std::memcpy(out, decode[in[i]].data(), 4);
+  for (std::size_t i = whole * 4; i < n; i++)
+    *out++ = decode[in[whole]][i % 4];
+}
+
+/*
+  Check whether the given file is in the packed format, by looking for the
+  magic string at its start.
+*/
+bool is_packed_file(std::string const &fname) {
+  std::ifstream input{fname, std::ios::binary};
+  char magic[4] = {0};
+  input.read(magic, sizeof magic);
+
+  return input && std::memcmp(magic, PACKED_MAGIC, 4) == 0;
+}
+
+/*
+  Map a packed sequence file, as written by util/pack_sequences.py. Engines that
+  can search the packed bases directly can use this object as-is.
+*/
+PackedSequences read_packed_sequences(std::string fname) {
+  return PackedSequences{fname};
+}
+
+/*
+  Map the sequence data from the given filename rather than reading it. This
+  is the zero-copy alternative to read_sequences(); the file format is the
+  same. A packed file is accepted as well, and is expanded to text in a single
+  buffer.
+*/
+SequenceData map_sequences(std::string fname) {
+  if (is_packed_file(fname))
+    return SequenceData{read_packed_sequences(fname)};
+
+  return SequenceData{fname};
+}
+
+/*
+  Map the pattern data from the given filename. As with read_patterns(), the
+  format is the same as the sequence data.
+*/
+SequenceData map_patterns(std::string fname) { return map_sequences(fname); }
+
 /*
   Read the answers data from the given filename. This data is different from
   the DNA-based data. The first line tells how many data-lines there are (one
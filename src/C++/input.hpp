@@ -5,11 +5,98 @@
 #ifndef _INPUT_HPP
 #define _INPUT_HPP
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// Constants describing the packed (2 bits per base) file format. The layout
+// is documented in util/pack_sequences.py, which writes these files.
+constexpr char PACKED_MAGIC[] = "DNA2";
+constexpr std::uint32_t PACKED_VERSION = 1;
+constexpr std::size_t PACKED_HEADER_SIZE = 24;
+constexpr char PACKED_ALPHABET[] = "ACGT";
+
+/*
+  A read-only view of a packed sequence file. The file is memory-mapped, and
+  each record's bases are available both in packed form (for code that can
+  search the 2-bit representation directly) and decoded to ASCII on request.
+*/
+class PackedSequences {
+public:
+  explicit PackedSequences(std::string const &fname);
+  PackedSequences(PackedSequences &&other) noexcept;
+  PackedSequences &operator=(PackedSequences &&other) noexcept;
+  PackedSequences(PackedSequences const &) = delete;
+  PackedSequences &operator=(PackedSequences const &) = delete;
+  ~PackedSequences();
+
+  std::size_t size() const { return count; }
+  std::size_t max_length() const { return max_len; }
+  std::size_t length(std::size_t idx) const { return lengths[idx]; }
+  std::uint8_t const *packed(std::size_t idx) const {
+    return bases + offsets[idx];
+  }
+  void unpack(std::size_t idx, char *out) const;
+
+private:
+  void *base = nullptr;
+  std::size_t map_length = 0;
+  std::uint64_t count = 0;
+  std::uint64_t max_len = 0;
+  // These all point into the mapping.
+  std::uint64_t const *offsets = nullptr;
+  std::uint32_t const *lengths = nullptr;
+  std::uint8_t const *bases = nullptr;
+};
+
+/*
+  A read-only view of a sequences (or patterns) file. The file is mapped into
+  memory with mmap(2) and each data-line is exposed as a std::string_view that
+  points directly into the mapping. All the lines share the one buffer, and
+  loading does no per-line allocation or copying. When built from a packed
+  file, the records are instead decoded into a single owned buffer, one byte
+  per base, so the packed format saves nothing once the data is loaded.
+
+  The object owns the mapping, so it can be moved but not copied. Views handed
+  out by operator[] are only valid for as long as the object lives.
+*/
+class SequenceData {
+public:
+  SequenceData() = default;
+  explicit SequenceData(std::string const &fname);
+  explicit SequenceData(PackedSequences const &packed);
+  SequenceData(SequenceData &&other) noexcept;
+  SequenceData &operator=(SequenceData &&other) noexcept;
+  SequenceData(SequenceData const &) = delete;
+  SequenceData &operator=(SequenceData const &) = delete;
+  ~SequenceData();
+
+  std::size_t size() const { return lines.size(); }
+  std::string_view operator[](std::size_t idx) const { return lines[idx]; }
+  std::vector<std::string_view>::const_iterator begin() const {
+    return lines.begin();
+  }
+  std::vector<std::string_view>::const_iterator end() const {
+    return lines.end();
+  }
+
+private:
+  void *base = nullptr;
+  std::size_t length = 0;
+  // Only used when the data was decoded from a packed file.
+  std::vector<char> buffer;
+  // The offset table: one view per data-line, in file order.
+  std::vector<std::string_view> lines;
+};
+
 extern std::vector<std::string> read_sequences(std::string fname);
 extern std::vector<std::string> read_patterns(std::string fname);
 extern std::vector<std::vector<int>> read_answers(std::string fname, int *k);
+extern SequenceData map_sequences(std::string fname);
+extern SequenceData map_patterns(std::string fname);
+extern bool is_packed_file(std::string const &fname);
+extern PackedSequences read_packed_sequences(std::string fname);
 
 #endif // !_INPUT_HPP
@@ -6,6 +6,7 @@
 */
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "run.hpp"
@@ -32,33 +33,39 @@ void make_next_table(std::string const &pat, int m,
   }
 }
 
-std::vector<PatternData> init_kmp(std::string const &pattern) {
-  std::vector<PatternData> return_val;
-  return_val.reserve(2);
+/*
+  The pre-processed form of a pattern, as used by kmp().
+*/
+struct KmpPattern {
+  std::string pattern;
+  std::vector<int> next_table;
+};
+
+KmpPattern init_kmp(std::string_view pattern) {
   int m = pattern.length();
   // Set up the next_table array for the algorithm to use:
   std::vector<int> next_table(m + 1, 0);
-  // Set up a copy of pattern, with the sentinel character added:
-  std::string pat(pattern + "\0");
+  // Set up a copy of pattern. A std::string always has a '\0' after its last
+  // character, which make_next_table() relies on as a sentinel.
+  std::string pat{pattern};
   make_next_table(pat, m, next_table);
 
-  return_val.push_back(pat);
-  return_val.push_back(next_table);
-
-  return return_val;
+  return {pat, next_table};
 }
 
 /*
   Perform the KMP algorithm on the given pattern of length m, against the
-  sequence of length n.
+  sequence of length n. `report` is called with the offset of each match.
 */
-int kmp(std::vector<PatternData> const &pat_data, std::string const &sequence) {
+template <typename Report>
+int kmp(KmpPattern const &pat_data, std::string_view sequence,
+        Report report) {
   int i, j;
   int matches = 0;
 
   // Unpack pat_data:
-  auto const &pattern = std::get<std::string>(pat_data[0]);
-  auto const &next_table = std::get<std::vector<int>>(pat_data[1]);
+  auto const &pattern = pat_data.pattern;
+  auto const &next_table = pat_data.next_table;
 
   // Get the size of the pattern and the sequence.
   int m = pattern.length();
@@ -74,6 +81,7 @@ int kmp(std::vector<PatternData> const &pat_data, std::string const &sequence) {
     j++;
     if (i >= m) {
       matches++;
+      report(j - m);
       i = next_table[i];
     }
   }
@@ -82,12 +90,32 @@ int kmp(std::vector<PatternData> const &pat_data, std::string const &sequence) {
 }
 
 /*
-  All that is done here is call the run() function with a pointer to the
-  algorithm implementation, the label for the algorithm, and the argc/argv
-  values.
+  The engine that hands the two functions above to the runner.
+*/
+struct Kmp {
+  typedef KmpPattern Compiled;
+  static Compiled init(std::string_view pattern) { return init_kmp(pattern); }
+  static int search(Compiled const &pat_data, std::string_view sequence) {
+    return kmp(pat_data, sequence, IgnoreMatch{});
+  }
+  template <typename Report>
+  static int search(Compiled const &pat_data, std::string_view sequence,
+                    Report report) {
+    return kmp(pat_data, sequence, report);
+  }
+};
+
+// Make the engine available to the combined binary as well.
+static RegisterEngine<Kmp> registration{"kmp"};
+
+#ifndef MULTI_ENGINE
+/*
+  All that is done here is call the run() function with the algorithm's
+  engine, the label for the algorithm, and the argc/argv values.
 */
 int main(int argc, char *argv[]) {
-  int return_code = run(&init_kmp, &kmp, "kmp", argc, argv);
+  int return_code = run<Kmp>("kmp", argc, argv);
 
   return return_code;
 }
+#endif // !MULTI_ENGINE
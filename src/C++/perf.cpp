@@ -0,0 +1,110 @@
+/*
+  Collection of hardware performance counters through perf_event_open(2), used
+  by the runners to count what the search phase does.
+*/
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf.hpp"
+
+char const *const PERF_COUNTER_NAMES[PERF_COUNTERS] = {
+    "cycles",      "instructions",  "l1d_misses",
+    "llc_misses",  "branch_misses", "dtlb_misses",
+};
+
+/*
+  The (type, config) pairs for each of the counters named above. The cache
+  events are encoded as cache | (operation << 8) | (result << 16).
+*/
+static const std::array<std::array<std::uint64_t, 2>, PERF_COUNTERS> EVENTS = {{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+}};
+
+PerfCounters::PerfCounters() { fds.fill(-1); }
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds)
+    if (fd != -1)
+      close(fd);
+}
+
+/*
+  Open the counters for the calling thread only (pid 0, any CPU). They start
+  out disabled, and count user-space only so that they work under the default
+  perf_event_paranoid setting.
+*/
+void PerfCounters::open() {
+  for (std::size_t idx = 0; idx < PERF_COUNTERS; idx++) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = EVENTS[idx][0];
+    attr.config = EVENTS[idx][1];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fds[idx] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+}
+
+/*
+  Start and stop counting. These may be called from any thread, not just the
+  one being counted.
+*/
+void PerfCounters::enable() {
+  for (int fd : fds)
+    if (fd != -1)
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void PerfCounters::disable() {
+  for (int fd : fds)
+    if (fd != -1)
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+/*
+  Read the counts so far. Each value is scaled by the fraction of the enabled
+  time that the counter was actually on the CPU. A counter that could not be
+  opened or read comes back as -1, as does one that was enabled but never got
+  onto the CPU (when there are more events than hardware counters), since its
+  count says nothing.
+*/
+std::array<double, PERF_COUNTERS> PerfCounters::read() const {
+  std::array<double, PERF_COUNTERS> values;
+
+  for (std::size_t idx = 0; idx < PERF_COUNTERS; idx++) {
+    // value, time_enabled, time_running
+    std::uint64_t data[3];
+    if (fds[idx] == -1 || ::read(fds[idx], data, sizeof data) != sizeof data) {
+      values[idx] = -1;
+      continue;
+    }
+    if (data[2] != 0)
+      values[idx] = (double)data[0] * data[1] / data[2];
+    else
+      values[idx] = data[1] != 0 ? -1 : 0.0;
+  }
+
+  return values;
+}
@@ -0,0 +1,43 @@
+/*
+  Header file for the hardware performance counter code.
+*/
+
+#ifndef _PERF_HPP
+#define _PERF_HPP
+
+#include <array>
+#include <cstddef>
+
+// The counters collected, in the order they are reported.
+constexpr std::size_t PERF_COUNTERS = 6;
+extern char const *const PERF_COUNTER_NAMES[PERF_COUNTERS];
+// The index of the last-level cache misses, each of which is a line read
+// from memory.
+constexpr std::size_t PERF_LLC_MISSES = 3;
+
+/*
+  A set of hardware counters for the thread that called open(). The counters
+  are opened individually rather than as a group, so that the kernel can
+  multiplex them when the CPU has fewer counter registers than there are
+  events; the values read are scaled up to make up for that.
+
+  Counters that cannot be opened (no PMU in a VM, perf_event_paranoid too
+  strict, event not supported) are simply left out, and read as negative.
+*/
+class PerfCounters {
+public:
+  PerfCounters();
+  PerfCounters(PerfCounters const &) = delete;
+  PerfCounters &operator=(PerfCounters const &) = delete;
+  ~PerfCounters();
+
+  void open();
+  void enable();
+  void disable();
+  std::array<double, PERF_COUNTERS> read() const;
+
+private:
+  std::array<int, PERF_COUNTERS> fds;
+};
+
+#endif // !_PERF_HPP
@@ -0,0 +1,148 @@
+/*
+  The thread pool used by the runners to spread the (pattern, sequence) work
+  over more than one core.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "pool.hpp"
+
+/*
+  Start the pool. Thread 0 is the caller of parallel_for(), so only
+  `count - 1` threads are actually created.
+*/
+WorkPool::WorkPool(int count)
+    : thread_count{std::max(count, 1)}, runs{new Run[thread_count]} {
+  for (int id = 0; id < thread_count; id++) {
+    runs[id].next = 0;
+    runs[id].end = 0;
+  }
+  for (int id = 1; id < thread_count; id++)
+    threads.emplace_back(&WorkPool::worker, this, id);
+}
+
+WorkPool::~WorkPool() {
+  {
+    std::lock_guard<std::mutex> guard{lock};
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+/*
+  Run `body` over [0, count) in blocks of `block` indices, on all threads of
+  the pool. Returns once every block is done. An exception thrown by the body
+  on any thread is re-thrown here.
+*/
+void WorkPool::parallel_for(std::size_t count, std::size_t block,
+                            Body const &body) {
+  if (count == 0)
+    return;
+  block = std::max(block, std::size_t{1});
+
+  // Deal the blocks out evenly, one contiguous run per thread.
+  std::size_t blocks = (count + block - 1) / block;
+  for (int id = 0; id < thread_count; id++) {
+    runs[id].next = blocks * id / thread_count;
+    runs[id].end = blocks * (id + 1) / thread_count;
+  }
+
+  job_body = &body;
+  job_task = nullptr;
+  job_count = count;
+  job_block = block;
+  start_job();
+}
+
+/*
+  Run `task` exactly once on every thread of the pool, for things that have to
+  be done per-thread (such as setting up thread-local resources). Returns once
+  all the threads have done it.
+*/
+void WorkPool::on_each(Task const &task) {
+  job_body = nullptr;
+  job_task = &task;
+  start_job();
+}
+
+/*
+  Wake the workers for the job that has been set up, take part in it as
+  thread 0, and wait for the others to finish. An exception thrown on any
+  thread is re-thrown here.
+*/
+void WorkPool::start_job() {
+  error = nullptr;
+
+  {
+    std::lock_guard<std::mutex> guard{lock};
+    pending = thread_count - 1;
+    generation++;
+  }
+  start_cv.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> guard{lock};
+  done_cv.wait(guard, [this] { return pending == 0; });
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/*
+  The loop run by each of the created threads: wait for a job, work on it,
+  report that it is done, and go back to waiting.
+*/
+void WorkPool::worker(int id) {
+  unsigned long seen = 0;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard{lock};
+      start_cv.wait(guard, [&] { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+    }
+
+    work(id);
+
+    {
+      std::lock_guard<std::mutex> guard{lock};
+      pending--;
+    }
+    done_cv.notify_one();
+  }
+}
+
+/*
+  Work through the blocks of the current job: first this thread's own run,
+  then whatever can be stolen from the other threads' runs. A per-thread task
+  is just run.
+*/
+void WorkPool::work(int id) {
+  try {
+    if (job_task != nullptr) {
+      (*job_task)(id);
+      return;
+    }
+    for (int victim = 0; victim < thread_count; victim++) {
+      Run &run = runs[(id + victim) % thread_count];
+      for (std::size_t idx = run.next++; idx < run.end; idx = run.next++) {
+        std::size_t begin = idx * job_block;
+        std::size_t end = std::min(begin + job_block, job_count);
+        (*job_body)(id, begin, end);
+      }
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> guard{lock};
+    if (!error)
+      error = std::current_exception();
+  }
+}
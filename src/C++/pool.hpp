@@ -0,0 +1,81 @@
+/*
+  Header file for the thread pool used by the runners.
+*/
+
+#ifndef _POOL_HPP
+#define _POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The size of a cache line, used to pad per-thread data so that two threads
+// never write to the same line.
+constexpr std::size_t CACHE_LINE = 64;
+
+/*
+  A persistent pool of worker threads that run a loop body over blocks of an
+  index range. The calling thread takes part as thread 0, so a pool of size 1
+  starts no threads at all and simply runs the body in place.
+
+  Scheduling is work-stealing: the blocks are first split evenly into one
+  contiguous run per thread, and each thread works through its own run from
+  the front. A thread that runs out steals single blocks from the front of the
+  other threads' runs, so a thread that drew slow blocks does not hold up the
+  rest.
+*/
+class WorkPool {
+public:
+  // The loop body. Called as body(thread, begin, end) for each block.
+  typedef std::function<void(int, std::size_t, std::size_t)> Body;
+  // A task to be run once on each thread. Called as task(thread).
+  typedef std::function<void(int)> Task;
+
+  explicit WorkPool(int count);
+  WorkPool(WorkPool const &) = delete;
+  WorkPool &operator=(WorkPool const &) = delete;
+  ~WorkPool();
+
+  int size() const { return thread_count; }
+  void parallel_for(std::size_t count, std::size_t block, Body const &body);
+  void on_each(Task const &task);
+
+private:
+  // One thread's run of blocks. `next` is taken by the owner and by thieves
+  // alike, so it is atomic and sits on its own cache line.
+  struct alignas(CACHE_LINE) Run {
+    std::atomic<std::size_t> next;
+    std::size_t end;
+  };
+
+  void start_job();
+  void worker(int id);
+  void work(int id);
+
+  int thread_count;
+  std::vector<std::thread> threads;
+  std::unique_ptr<Run[]> runs;
+
+  // The job currently being run: either a loop body or a per-thread task.
+  Body const *job_body = nullptr;
+  Task const *job_task = nullptr;
+  std::size_t job_count = 0;
+  std::size_t job_block = 0;
+
+  // Start/finish signalling between the calling thread and the workers.
+  std::mutex lock;
+  std::condition_variable start_cv, done_cv;
+  unsigned long generation = 0;
+  int pending = 0;
+  bool stopping = false;
+  // The first exception thrown by the body on any thread, if there was one.
+  std::exception_ptr error;
+};
+
+#endif // !_POOL_HPP
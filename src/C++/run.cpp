@@ -3,15 +3,25 @@
   an experiment.
 */
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <getopt.h>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
-#include <sys/time.h>
+#include <string_view>
+#include <unistd.h>
 #include <vector>
 
 #include "input.hpp"
+#include "perf.hpp"
 #include "run.hpp"
 
 #if defined(__INTEL_LLVM_COMPILER)
@@ -22,210 +32,426 @@
 #define LANG "cpp-gcc"
 #endif
 
+// The tile size to fall back on when the L2 cache size cannot be found.
+constexpr std::size_t DEFAULT_TILE_BYTES = 256 * 1024;
+
 /*
-  Simple measure of the wall-clock down to the usec. Adapted from StackOverflow.
+  Time in seconds from the monotonic clock. Unlike the wall-clock, this never
+  jumps when the system time is adjusted, so differences between two readings
+  are always true intervals.
 */
 double get_time() {
-  struct timeval t;
-  gettimeofday(&t, NULL);
-  return t.tv_sec + t.tv_usec * 1e-6;
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
 }
 
 /*
-  The "runner" function. This takes a pointer to an algorithm implementation,
-  the name of the algorithm, argc and argv from the invocation, and runs the
-  experiment over the given algorithm.
+  Work out a tile size from the size of the L2 cache. Half of the cache is
+  used, to leave room for the pattern tables and everything else. glibc can
+  usually report the size directly; failing that, try sysfs.
+*/
+std::size_t detect_tile_bytes() {
+  long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+  if (l2 <= 0) {
+    std::ifstream input{"/sys/devices/system/cpu/cpu0/cache/index2/size"};
+    std::string size;
+    if (input >> size) {
+      l2 = std::stol(size);
+      if (size.back() == 'K')
+        l2 *= 1024;
+      else if (size.back() == 'M')
+        l2 *= 1024 * 1024;
+    }
+  }
 
-  The return value is 0 if the experiment correctly identified all pattern
-  instances in all sequences, and the number of misses otherwise. An exception
-  is thrown on non-recoverable errors.
+  return l2 > 0 ? l2 / 2 : DEFAULT_TILE_BYTES;
+}
+
+/*
+  Parse any leading options into `options`, and check that the number of
+  positional arguments that remain is between `min_args` and `max_args`. The
+  `-b` option is only accepted if `tiled` is true. The return value is the
+  index in argv of the first positional argument.
 */
-int run(initializer init, algorithm code, std::string name, int argc,
-        char *argv[]) {
-  if (argc < 3 || argc > 4) {
+int parse_options(int argc, char *argv[], bool tiled, int min_args,
+                  int max_args, std::string const &usage,
+                  RunOptions &options) {
+  int opt;
+  bool ok = true;
+  // The "+" stops option processing at the first positional argument.
+  char const *optstring = tiled ? "+t:b:r:w:po:a" : "+t:r:w:po:a";
+
+  while ((opt = getopt(argc, argv, optstring)) != -1) {
+    switch (opt) {
+    case 't':
+      options.threads = std::stoi(optarg);
+      if (options.threads < 1)
+        ok = false;
+      break;
+    case 'b':
+      if (std::string{optarg} == "auto")
+        options.tile_bytes = detect_tile_bytes();
+      else
+        options.tile_bytes = std::stoul(optarg);
+      if (options.tile_bytes == 0)
+        ok = false;
+      break;
+    case 'r':
+      options.repetitions = std::stoi(optarg);
+      if (options.repetitions < 1)
+        ok = false;
+      break;
+    case 'w':
+      options.warmups = std::stoi(optarg);
+      if (options.warmups < 0)
+        ok = false;
+      break;
+    case 'p':
+      options.perf = true;
+      break;
+    case 'o':
+      options.positions = optarg;
+      break;
+    case 'a':
+      options.all_k = true;
+      break;
+    default:
+      ok = false;
+      break;
+    }
+  }
+
+  int remaining = argc - optind;
+  if (!ok || remaining < min_args || remaining > max_args) {
     std::ostringstream error;
-    error << "Usage: " << argv[0] << " <sequences> <patterns> [ <answers> ]";
+    error << "Usage: " << argv[0] << " [ -t <threads> ] "
+          << (tiled ? "[ -b <bytes>|auto ] " : "")
+          << "[ -r <repetitions> ] [ -w <warmups> ] [ -p ] "
+          << "[ -o <positions> ] [ -a ] " << usage;
     throw std::runtime_error{error.str()};
   }
 
-  // Read the three data files. Any of these that encounter an error will
-  // throw an exception. The filenames are in the order: sequences patterns
-  // answers.
-  std::vector<std::string> sequences_data = read_sequences(argv[1]);
-  int sequences_count = sequences_data.size();
-  std::vector<std::string> patterns_data = read_patterns(argv[2]);
-  int patterns_count = patterns_data.size();
-  std::vector<std::vector<int>> answers_data;
-  if (argc == 4) {
-    answers_data = read_answers(argv[3], nullptr);
-    int answers_count = answers_data.size();
-    if (answers_count != patterns_count)
+  return optind;
+}
+
+/*
+  Read the answers file for approximate matching with the given k. `answers`
+  is a printf-style format that k is filled in to.
+*/
+std::vector<std::vector<int>> read_approx_answers(char const *answers, int k) {
+  int k_read;
+  char answers_file[256];
+  snprintf(answers_file, sizeof answers_file, answers, k);
+  auto data = read_answers(answers_file, &k_read);
+  if (k != k_read)
+    throw std::runtime_error{"Mismatch in k value in answers file"};
+
+  return data;
+}
+
+/*
+  Read the data files for an experiment. `answers` may be null, in which case
+  there is no checking of results. For approximate matching `k` is the value
+  of k, and `answers` is a printf-style format that k is filled in to; with
+  `all_k`, the answers are read for every k from 1 up to that. For exact
+  matching `k` is negative. Any of these that encounter an error will throw
+  an exception.
+*/
+Experiment load_experiment(char const *sequences, char const *patterns,
+                           char const *answers, int k, bool all_k) {
+  if (all_k && k < 1)
+    throw std::runtime_error{
+        "Counting for every k needs approximate matching, with k of 1 or more"};
+
+  Experiment data;
+  data.k = k;
+  data.all_k = all_k;
+  data.sequences = map_sequences(sequences);
+  data.patterns = map_patterns(patterns);
+
+  auto check_count = [&](std::size_t answers_count) {
+    if (answers_count != data.patterns.size())
       throw std::runtime_error{
           "Count mismatch between patterns file and answers file"};
+  };
+  if (answers != nullptr && k < 0) {
+    data.answers = read_answers(answers, nullptr);
+    check_count(data.answers.size());
+  } else if (answers != nullptr) {
+    for (int j = all_k ? 1 : k; j <= k; j++) {
+      auto answers_j = read_approx_answers(answers, j);
+      check_count(answers_j.size());
+      for (auto &row : answers_j)
+        data.answers.push_back(std::move(row));
+    }
   }
 
-  // Run it. For each sequence, try each pattern against it. The code function
-  // pointer will return the number of matches found, which will be compared to
-  // the table of answers for that pattern. Report any mismatches.
-  double start_time = get_time();
-  int return_code = 0; // Used for noting if some number of matches fail
-  for (int pattern = 0; pattern < patterns_count; pattern++) {
-    std::string pattern_str = patterns_data[pattern];
-    // Pre-process the pattern before applying it to all sequences.
-    std::vector<PatternData> pat_data = (*init)(pattern_str);
-
-    for (int sequence = 0; sequence < sequences_count; sequence++) {
-      std::string sequence_str = sequences_data[sequence];
-
-      int matches = (*code)(pat_data, sequence_str);
-
-      if (answers_data.size() && matches != answers_data[pattern][sequence]) {
-        std::cerr << "Pattern " << pattern + 1 << " mismatch against sequence "
-                  << sequence + 1 << " (" << matches
-                  << " != " << answers_data[pattern][sequence] << ")\n";
-        return_code++;
-      }
+  return data;
+}
+
+/*
+  Split the sequences into tiles: runs of consecutive sequences holding at most
+  `tile_bytes` bytes of data between them (but always at least one sequence).
+  The return value holds the index of the first sequence of each tile, plus a
+  final entry for the end of the data.
+*/
+std::vector<std::size_t> make_tiles(SequenceData const &sequences,
+                                    std::size_t tile_bytes) {
+  std::vector<std::size_t> tiles{0};
+  std::size_t bytes = 0;
+
+  for (std::size_t sequence = 0; sequence < sequences.size(); sequence++) {
+    std::size_t length = sequences[sequence].length();
+    if (sequence != tiles.back() && bytes + length > tile_bytes) {
+      tiles.push_back(sequence);
+      bytes = 0;
     }
+    bytes += length;
   }
-  // Note the end time.
-  double end_time = get_time();
+  tiles.push_back(sequences.size());
 
-  std::cout << "language: " << LANG << "\n"
-            << "algorithm: " << name << "\n"
-            << "runtime: " << std::setprecision(8) << end_time - start_time
-            << "\n";
-
-  return return_code;
+  return tiles;
 }
 
 /*
-  This is a variation of "run" that handles algorithms that do multi-pattern
-  matching.
+  Write the tiling figures to stdout: the tile size and count, and estimates
+  of how many bytes of sequence data are streamed in from memory, tiled and
+  untiled. Both estimates follow from the data alone. Tiled, each tile is
+  taken to be brought in once and reused by every pattern; untiled, every
+  pattern is taken to stream the whole of the data through the cache again.
+  So they differ by the number of patterns whether or not tiling helps.
+
+  The measured figure is `llc_miss_bytes`, the bytes read in by last-level
+  cache misses during one search, which is given with -p. Setting that
+  against llc_misses times the line size for a run without -b shows what
+  tiling saved.
 */
-int run_multi(mp_initializer init, mp_algorithm code, std::string name,
-              int argc, char *argv[]) {
-  if (argc < 3 || argc > 4) {
-    std::ostringstream error;
-    error << "Usage: " << argv[0] << " <sequences> <patterns> [ <answers> ]";
-    throw std::runtime_error{error.str()};
-  }
+void report_tiling(RunOptions const &options, std::size_t tiles,
+                   SequenceData const &sequences, std::size_t patterns,
+                   std::array<double, PERF_COUNTERS> const &events) {
+  std::size_t bytes = 0;
+  for (auto const &sequence : sequences)
+    bytes += sequence.length();
 
-  // Read the three data files. Any of these that encounter an error will
-  // throw an exception. The filenames are in the order: sequences patterns
-  // answers.
-  std::vector<std::string> sequences_data = read_sequences(argv[1]);
-  int sequences_count = sequences_data.size();
-  std::vector<std::string> patterns_data = read_patterns(argv[2]);
-  int patterns_count = patterns_data.size();
-  std::vector<std::vector<int>> answers_data;
-  if (argc == 4) {
-    answers_data = read_answers(argv[3], nullptr);
-    int answers_count = answers_data.size();
-    if (answers_count != patterns_count)
-      throw std::runtime_error{
-          "Count mismatch between patterns file and answers file"};
+  std::cout << "tile_bytes: " << options.tile_bytes << "\n"
+            << "tiles: " << tiles << "\n"
+            << "streamed_bytes_estimate: " << bytes << "\n"
+            << "untiled_streamed_bytes_estimate: " << bytes * patterns << "\n";
+  if (events[PERF_LLC_MISSES] >= 0) {
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(0)
+              << "llc_miss_bytes: " << events[PERF_LLC_MISSES] * CACHE_LINE
+              << "\n"
+              << std::defaultfloat << std::setprecision(precision);
   }
+}
 
-  // Run it. For each sequence, try each pattern against it. The code function
-  // pointer will return the number of matches found, which will be compared to
-  // the table of answers for that pattern. Report any mismatches.
-  double start_time = get_time();
-  int return_code = 0; // Used for noting if some number of matches fail
-
-  // Pre-process the patterns before applying to all sequences.
-  std::vector<MultiPatternData> pat_data = (*init)(patterns_data);
-
-  for (int sequence = 0; sequence < sequences_count; sequence++) {
-    std::string sequence_str = sequences_data[sequence];
-
-    std::vector<int> matches = (*code)(pat_data, sequence_str);
-
-    if (answers_data.size()) {
-      for (int pattern = 0; pattern < patterns_count; pattern++) {
-        if (matches[pattern] != answers_data[pattern][sequence]) {
-          std::cerr << "Pattern " << pattern + 1
-                    << " mismatch against sequence " << sequence + 1 << " ("
-                    << matches[pattern]
-                    << " != " << answers_data[pattern][sequence] << ")\n";
-          return_code++;
-        }
-      }
+/*
+  Check the table of results against the answers, if there are any. The
+  mismatches are returned in the order a serial run would have found them:
+  pattern by pattern normally, or sequence by sequence if `by_sequence` is
+  true (which is how the multi-pattern runner goes). An experiment for every
+  k is checked one k at a time, from 1 up.
+*/
+std::vector<Mismatch> verify_results(Experiment const &data,
+                                     MatchTable const &results,
+                                     bool by_sequence) {
+  std::vector<Mismatch> mismatches;
+  if (data.answers.empty())
+    return mismatches;
+
+  int patterns_count = data.patterns.size();
+  int sequences_count = data.sequences.size();
+  for (int j = 0; j < k_count(data); j++) {
+    int k = data.all_k ? j + 1 : -1;
+    auto check = [&](int pattern, int sequence) {
+      int row = j * patterns_count + pattern;
+      int expected = data.answers[row][sequence];
+      if (results(row, sequence) != expected)
+        mismatches.push_back(
+            {pattern, sequence, results(row, sequence), expected, k});
+    };
+
+    if (by_sequence) {
+      for (int sequence = 0; sequence < sequences_count; sequence++)
+        for (int pattern = 0; pattern < patterns_count; pattern++)
+          check(pattern, sequence);
+    } else {
+      for (int pattern = 0; pattern < patterns_count; pattern++)
+        for (int sequence = 0; sequence < sequences_count; sequence++)
+          check(pattern, sequence);
     }
   }
-  // Note the end time.
-  double end_time = get_time();
 
-  std::cout << "language: " << LANG << "\n"
-            << "algorithm: " << name << "\n"
-            << "runtime: " << std::setprecision(8) << end_time - start_time
-            << "\n";
-
-  return return_code;
+  return mismatches;
 }
 
-int run_approx(am_initializer init, am_algorithm code, std::string name,
-               int argc, char *argv[]) {
-  if (argc < 4 || argc > 5) {
-    std::ostringstream error;
-    error << "Usage: " << argv[0]
-          << " <k> <sequences> <patterns> [ <answers> ]";
-    throw std::runtime_error{error.str()};
+/*
+  Report the mismatches on stderr.
+*/
+void report_mismatches(std::vector<Mismatch> const &mismatches) {
+  for (auto const &miss : mismatches) {
+    std::cerr << "Pattern " << miss.pattern + 1 << " mismatch against sequence "
+              << miss.sequence + 1 << " (" << miss.found
+              << " != " << miss.expected << ")";
+    if (miss.k >= 0)
+      std::cerr << " for k = " << miss.k;
+    std::cerr << "\n";
   }
+}
 
-  // Read the initial integer and three data files. Any of these that encounter
-  // an error will throw an exception. The filenames are in the order: sequences
-  // patterns answers.
-  int k = std::stoi(argv[1]);
-  std::vector<std::string> sequences_data = read_sequences(argv[2]);
-  int sequences_count = sequences_data.size();
-  std::vector<std::string> patterns_data = read_patterns(argv[3]);
-  int patterns_count = patterns_data.size();
-  std::vector<std::vector<int>> answers_data;
-  if (argc == 5) {
-    int k_read;
-    char answers_file[256];
-    sprintf(answers_file, argv[4], k);
-    answers_data = read_answers(answers_file, &k_read);
-    int answers_count = answers_data.size();
-    if (answers_count != patterns_count)
-      throw std::runtime_error{
-          "Count mismatch between patterns file and answers file"};
-    if (k != k_read)
-      throw std::runtime_error{"Mismatch in k value in answers file"};
+/*
+  Summarize a set of timings, such as one phase's times from all the
+  repetitions.
+*/
+Summary summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  std::size_t n = values.size();
+
+  double mean = 0.0;
+  for (double value : values)
+    mean += value;
+  mean /= n;
+  double squares = 0.0;
+  for (double value : values)
+    squares += (value - mean) * (value - mean);
+
+  Summary summary;
+  summary.min = values.front();
+  summary.median = n % 2 ? values[n / 2]
+                         : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+  // Nearest-rank percentile.
+  summary.p95 = values[std::max<std::size_t>(std::ceil(0.95 * n), 1) - 1];
+  // Sample standard deviation; zero when there is only the one sample.
+  summary.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+
+  return summary;
+}
+
+std::ostream &operator<<(std::ostream &out, Summary const &summary) {
+  return out << "{ min: " << summary.min << ", median: " << summary.median
+             << ", p95: " << summary.p95 << ", stddev: " << summary.stddev
+             << " }";
+}
+
+/*
+  Write the results of a run to stdout, in the YAML-ish form that the harness
+  collects.
+
+  `runtime` is the median over the repetitions of the time for pre-processing,
+  searching and checking together, which is what a single run used to
+  measure. The time to load the data is reported on its own, and each of the
+  other phases is summarized over the repetitions. Throughput is based on the
+  median search time, where one "pass" is one search of every sequence:
+  single-pattern runs make one pass per pattern.
+*/
+void report_run(std::string const &name, Experiment const &data,
+                RunOptions const &options, int threads, double load_time,
+                std::vector<PhaseTimes> const &times, std::size_t passes) {
+  std::vector<double> preprocess, search, verify, total;
+  for (auto const &time : times) {
+    preprocess.push_back(time.preprocess);
+    search.push_back(time.search);
+    verify.push_back(time.verify);
+    total.push_back(time.preprocess + time.search + time.verify);
   }
+  Summary search_summary = summarize(search);
+
+  std::size_t bytes = 0;
+  for (auto const &sequence : data.sequences)
+    bytes += sequence.length();
+  double bytes_rate = passes * bytes / search_summary.median;
+  double sequences_rate =
+      passes * data.sequences.size() / search_summary.median;
+
+  std::cout << std::setprecision(8) << "language: " << LANG << "\n"
+            << "algorithm: " << name << "\n";
+  if (data.k >= 0)
+    std::cout << "k: " << data.k << "\n";
+  if (data.all_k)
+    std::cout << "all_k: true\n";
+  std::cout << "threads: " << threads << "\n"
+            << "runtime: " << summarize(total).median << "\n"
+            << "repetitions: " << options.repetitions << "\n"
+            << "warmups: " << options.warmups << "\n"
+            << "load_time: " << load_time << "\n"
+            << "preprocess_time: " << summarize(preprocess) << "\n"
+            << "search_time: " << search_summary << "\n"
+            << "verify_time: " << summarize(verify) << "\n"
+            << "search_bytes_per_sec: " << bytes_rate << "\n"
+            << "search_sequences_per_sec: " << sequences_rate << "\n";
+}
+
+/*
+  Write the number of match positions written to the positions file, and how
+  long it took, to stdout.
+*/
+void report_positions(std::size_t count, double time) {
+  std::cout << "positions: " << count << "\n"
+            << "positions_time: " << time << "\n";
+}
 
-  // Run it. For each sequence, try each pattern against it. The code
-  // function pointer will return the number of matches found, which will be
-  // compared to the table of answers for that pattern. Report any
-  // mismatches.
-  double start_time = get_time();
-  int return_code = 0; // Used for noting if some number of matches fail
-  for (int pattern = 0; pattern < patterns_count; pattern++) {
-    std::string pattern_str = patterns_data[pattern];
-    // Pre-process the pattern before applying it to all sequences.
-    std::vector<MultiPatternData> pat_data = (*init)(pattern_str, k);
-
-    for (int sequence = 0; sequence < sequences_count; sequence++) {
-      std::string sequence_str = sequences_data[sequence];
-
-      int matches = (*code)(pat_data, sequence_str);
-
-      if (answers_data.size() && matches != answers_data[pattern][sequence]) {
-        std::cerr << "Pattern " << pattern + 1 << " mismatch against sequence "
-                  << sequence + 1 << " (" << matches
-                  << " != " << answers_data[pattern][sequence] << ")\n";
-        return_code++;
+/*
+  Write the hardware counts to stdout, summed over the threads and averaged
+  over the repetitions, so that they describe one search phase just as
+  `runtime` describes one repetition. Instructions per cycle is derived from
+  the first two. An event is only reported if every thread counted it, as a
+  sum over some of the threads would be too low; the others are left out,
+  with a warning on stderr (a VM with no PMU, a restrictive
+  perf_event_paranoid, or more events than counter registers are the usual
+  causes).
+
+  The figures for one search are returned as well, with -1 for the events
+  that were left out.
+*/
+std::array<double, PERF_COUNTERS> report_counters(
+    std::vector<std::unique_ptr<PerfCounters>> const &counters,
+    int repetitions) {
+  std::array<double, PERF_COUNTERS> totals{};
+  std::array<std::size_t, PERF_COUNTERS> counted{};
+  for (auto const &counter : counters) {
+    auto values = counter->read();
+    for (std::size_t idx = 0; idx < PERF_COUNTERS; idx++)
+      if (values[idx] >= 0) {
+        totals[idx] += values[idx];
+        counted[idx]++;
       }
-    }
   }
-  // Note the end time.
-  double end_time = get_time();
 
-  std::cout << "language: " << LANG << "\n"
-            << "algorithm: " << name << "\n"
-            << "k: " << k << "\n"
-            << "runtime: " << std::setprecision(8) << end_time - start_time
-            << "\n";
+  std::array<bool, PERF_COUNTERS> complete;
+  std::array<double, PERF_COUNTERS> events;
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::fixed << std::setprecision(0);
+  for (std::size_t idx = 0; idx < PERF_COUNTERS; idx++) {
+    complete[idx] = counted[idx] == counters.size();
+    events[idx] = complete[idx] ? totals[idx] / repetitions : -1;
+    if (complete[idx])
+      std::cout << PERF_COUNTER_NAMES[idx] << ": "
+                << events[idx] << "\n";
+    else if (counted[idx] == 0)
+      std::cerr << "Warning: hardware counter " << PERF_COUNTER_NAMES[idx]
+                << " is not available\n";
+    else
+      std::cerr << "Warning: hardware counter " << PERF_COUNTER_NAMES[idx]
+                << " was only counted on " << counted[idx] << " of "
+                << counters.size() << " threads, and is left out\n";
+  }
+  if (complete[0] && complete[1] && totals[0] > 0)
+    std::cout << std::setprecision(3) << "ipc: " << totals[1] / totals[0]
+              << "\n";
+  std::cout << std::defaultfloat << std::setprecision(precision);
 
-  return return_code;
+  return events;
+}
+
+/*
+  The registry of engines. It is built up by the static initializers of the
+  engines' source files, so it is created on first use rather than being a
+  plain global whose construction might come too late.
+*/
+std::vector<RegisteredEngine> &engine_registry() {
+  static std::vector<RegisteredEngine> registry;
+  return registry;
 }
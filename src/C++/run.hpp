@@ -1,38 +1,931 @@
 /*
   Header file for the runner module.
+
+  The runners are templates over the algorithm being run, so that each
+  program gets its own copy of the loops with the algorithm's calls made
+  directly (and inlined where the compiler sees fit). The parts that do not
+  depend on the algorithm live in run.cpp.
 */
 
 #ifndef _RUN_HPP
 #define _RUN_HPP
 
-#include <set>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
 #include <string>
-#include <variant>
+#include <string_view>
 #include <vector>
 
-typedef std::variant<std::string, std::vector<int>, unsigned long,
-                     std::vector<unsigned long>>
-    PatternData;
-typedef int (*algorithm)(std::vector<PatternData> const &, std::string const &);
-typedef std::vector<PatternData> (*initializer)(std::string const &);
-extern int run(initializer init, algorithm algo, std::string name, int argc,
-               char *argv[]);
-
-typedef std::variant<int, std::vector<int>, std::vector<std::vector<int>>,
-                     std::vector<std::set<int>>>
-    MultiPatternData;
-typedef std::vector<int> (*mp_algorithm)(std::vector<MultiPatternData> const &,
-                                         std::string const &);
-typedef std::vector<MultiPatternData> (*mp_initializer)(
-    std::vector<std::string> const &);
-extern int run_multi(mp_initializer init, mp_algorithm algo, std::string name,
-                     int argc, char *argv[]);
-
-typedef int (*am_algorithm)(std::vector<MultiPatternData> const &,
-                            std::string const &);
-typedef std::vector<MultiPatternData> (*am_initializer)(std::string const &,
-                                                        int);
-extern int run_approx(am_initializer init, am_algorithm algo, std::string name,
-                      int argc, char *argv[]);
+#include "input.hpp"
+#include "perf.hpp"
+#include "pool.hpp"
+#include "sink.hpp"
+
+/*
+  The engine interfaces. An engine is a type that names the pre-processed
+  ("compiled") form of its pattern(s) as `Compiled`, and has two static
+  functions: `init`, which compiles, and `search`, which runs the compiled
+  form against one sequence.
+
+  A single-pattern engine compiles one pattern and returns the number of
+  matches found.
+*/
+template <typename E>
+concept PatternEngine =
+    requires(std::string_view text, typename E::Compiled const &pat_data) {
+      { E::init(text) } -> std::same_as<typename E::Compiled>;
+      { E::search(pat_data, text) } -> std::same_as<int>;
+    };
+
+/*
+  A multi-pattern engine compiles the full list of patterns, and returns the
+  number of matches of each of them.
+*/
+template <typename E>
+concept MultiPatternEngine =
+    requires(std::vector<std::string_view> const &patterns,
+             std::string_view text, typename E::Compiled const &pat_data) {
+      { E::init(patterns) } -> std::same_as<typename E::Compiled>;
+      { E::search(pat_data, text) } -> std::same_as<std::vector<int>>;
+    };
+
+/*
+  An approximate-matching engine compiles one pattern for a given k.
+*/
+template <typename E>
+concept ApproxEngine = requires(std::string_view text, int k,
+                                typename E::Compiled const &pat_data) {
+  { E::init(text, k) } -> std::same_as<typename E::Compiled>;
+  { E::search(pat_data, text) } -> std::same_as<int>;
+};
+
+/*
+  A multi-pattern approximate-matching engine compiles the full list of
+  patterns for a given k, and returns the number of matches of each of them.
+*/
+template <typename E>
+concept MultiApproxEngine =
+    requires(std::vector<std::string_view> const &patterns, int k,
+             std::string_view text, typename E::Compiled const &pat_data) {
+      { E::init(patterns, k) } -> std::same_as<typename E::Compiled>;
+      { E::search(pat_data, text) } -> std::same_as<std::vector<int>>;
+    };
+
+/*
+  An engine of any of these kinds may also be able to say where its matches
+  are, with a search that takes a callback as a third argument. This is called
+  with the offset of the start of each match, preceded by the index of the
+  pattern for a multi-pattern engine.
+
+  The engines write their search loop once, with the callback, and the count-
+  only search passes IgnoreMatch. That does nothing and is inlined away, so
+  counting costs what it did before positions could be reported.
+*/
+struct IgnoreMatch {
+  void operator()(std::size_t) const {}
+  void operator()(int, std::size_t) const {}
+};
+
+template <typename E>
+concept ReportsPositions =
+    requires(std::string_view text, typename E::Compiled const &pat_data) {
+      E::search(pat_data, text, IgnoreMatch{});
+    };
+
+/*
+  An approximate-matching engine may also be able to count its matches for
+  every value of k up to the one it was compiled for, in a single search. For
+  each match, its search_gaps() adds one to counts[j], where j (from 0 to k)
+  is the smallest k that the match would be found with. The count for any k
+  is then the sum of counts[0] to counts[k].
+*/
+template <typename E>
+concept AllGapsEngine = requires(std::string_view text, int *counts,
+                                 typename E::Compiled const &pat_data) {
+  E::search_gaps(pat_data, text, counts);
+};
+
+// The number of sequences in each block of work handed to the thread pool.
+// Small enough that stealing can even out the load, large enough that the
+// scheduling cost disappears next to the matching.
+constexpr std::size_t SEQUENCE_BLOCK = 64;
+
+/*
+  The options that may precede the positional arguments:
+
+    -t <threads>       Number of threads to spread the sequences over
+                       (default 1)
+    -b <bytes>|auto    Run tiled: keep blocks of at most this many bytes of
+                       sequence data in cache while all of the patterns are
+                       run over them. "auto" sizes the blocks from the L2
+                       cache. Only for the single-pattern runners; the
+                       default is the untiled, pattern-by-pattern order.
+    -r <count>         Number of timed repetitions of the experiment, from
+                       which the timing statistics are drawn (default 1)
+    -w <count>         Number of untimed warm-up repetitions to do before
+                       the timed ones (default 0)
+    -p                 Count hardware events (cycles, cache misses and so
+                       on) during the search phase, on every thread
+    -o <file>          Write the position of every match to this file (in
+                       the format described in sink.hpp). This is done in
+                       an extra, untimed pass after the timed repetitions
+    -a                 For approximate matching, count the matches for
+                       every k from 1 up to the one given, in the one
+                       search, and check each against its answers file.
+                       Only for the engines that can (see AllGapsEngine);
+                       any positions written are those for the largest k
+*/
+struct RunOptions {
+  int threads = 1;
+  std::size_t tile_bytes = 0;
+  int repetitions = 1;
+  int warmups = 0;
+  bool perf = false;
+  std::string positions;
+  bool all_k = false;
+};
+
+/*
+  The data for one experiment: the sequences, the patterns and (if an answers
+  file was given) the expected number of matches of each pattern in each
+  sequence. For approximate matching, `k` is the value of k; otherwise it is
+  negative.
+
+  With `all_k`, the experiment is for every k from 1 up to `k`, and the
+  answers for each of those follow one another: the answers for pattern p at
+  k = j are answers[(j - 1) * patterns.size() + p]. The table of results is
+  laid out the same way.
+*/
+struct Experiment {
+  SequenceData sequences;
+  SequenceData patterns;
+  std::vector<std::vector<int>> answers;
+  int k = -1;
+  bool all_k = false;
+};
+
+// The number of values of k that an experiment counts matches for.
+inline int k_count(Experiment const &data) { return data.all_k ? data.k : 1; }
+
+/*
+  The number of matches found for each (pattern, sequence) pair. The search
+  fills this in, and it is checked against the answers afterwards, so that the
+  two can be timed separately. Each cell is written by exactly one thread.
+
+  The full table is only kept when it is going to be read (when there are
+  answers to check it against). Otherwise each sequence's counts are just
+  added up, which keeps the results of the search live without a table of
+  patterns times sequences: for a dictionary of a million patterns, that
+  would run to gigabytes. Every runner gives each sequence to one thread at a
+  time, so the sums need no more care than the cells.
+*/
+struct MatchTable {
+  MatchTable(std::size_t patterns, std::size_t sequences, bool full = true)
+      : sequences{sequences}, full{full},
+        counts(full ? patterns * sequences : 0),
+        totals(full ? 0 : sequences) {}
+
+  void set(int pattern, int sequence, int count) {
+    if (full)
+      counts[pattern * sequences + sequence] = count;
+    else
+      totals[sequence] += count;
+  }
+  // Only for a full table.
+  int operator()(int pattern, int sequence) const {
+    return counts[pattern * sequences + sequence];
+  }
+
+  std::size_t sequences;
+  bool full;
+  std::vector<int> counts;
+  // The sums for each sequence, when the table is not full. These are
+  // unsigned so that they can wrap.
+  std::vector<unsigned> totals;
+};
+
+/*
+  A multi-pattern engine may also be able to pre-process its patterns with
+  the threads of a pool, as E::init(patterns, pool). The runners pass theirs
+  when it can.
+*/
+template <typename E>
+concept PoolInitEngine =
+    requires(std::vector<std::string_view> const &patterns, WorkPool &pool) {
+      { E::init(patterns, pool) } -> std::same_as<typename E::Compiled>;
+    };
+
+/*
+  A multi-pattern engine may also be able to search a whole block of
+  sequences (those from `begin` up to `end`) in one go, filling in the table
+  of results itself. The runners use this when it is there, which lets an
+  engine work on several sequences at the same time.
+*/
+template <typename E>
+concept BlockSearchEngine =
+    requires(typename E::Compiled const &pat_data,
+             SequenceData const &sequences, std::size_t begin,
+             MatchTable &results) {
+      E::search_block(pat_data, sequences, begin, begin, results);
+    };
+
+/*
+  A (pattern, sequence) pair whose match count did not agree with the answers
+  file.
+*/
+struct Mismatch {
+  int pattern;
+  int sequence;
+  int found;
+  int expected;
+  // The value of k, if the experiment is for all of them; otherwise -1.
+  int k;
+};
+
+/*
+  How long each timed phase of one repetition took, in seconds.
+*/
+struct PhaseTimes {
+  double preprocess;
+  double search;
+  double verify;
+};
+
+/*
+  Summary statistics over a set of timings.
+*/
+struct Summary {
+  double min;
+  double median;
+  double p95;
+  double stddev;
+};
+
+extern double get_time();
+extern int parse_options(int argc, char *argv[], bool tiled, int min_args,
+                         int max_args, std::string const &usage,
+                         RunOptions &options);
+extern Experiment load_experiment(char const *sequences, char const *patterns,
+                                  char const *answers, int k,
+                                  bool all_k = false);
+extern std::vector<std::size_t> make_tiles(SequenceData const &sequences,
+                                           std::size_t tile_bytes);
+extern std::vector<Mismatch> verify_results(Experiment const &data,
+                                            MatchTable const &results,
+                                            bool by_sequence);
+extern Summary summarize(std::vector<double> values);
+extern std::ostream &operator<<(std::ostream &out, Summary const &summary);
+extern void report_mismatches(std::vector<Mismatch> const &mismatches);
+extern void report_run(std::string const &name, Experiment const &data,
+                       RunOptions const &options, int threads,
+                       double load_time, std::vector<PhaseTimes> const &times,
+                       std::size_t passes);
+extern void report_positions(std::size_t count, double time);
+extern std::array<double, PERF_COUNTERS> report_counters(
+    std::vector<std::unique_ptr<PerfCounters>> const &counters,
+    int repetitions);
+extern void report_tiling(RunOptions const &options, std::size_t tiles,
+                          SequenceData const &sequences, std::size_t patterns,
+                          std::array<double, PERF_COUNTERS> const &events);
+
+/*
+  Drive the phases of an experiment whose data has already been loaded (in
+  `load_time` seconds). `compile` takes the thread pool, pre-processes the
+  patterns and returns the result, and `search` takes that, the thread pool
+  and the table of results and fills in the table. The answers are then
+  checked.
+
+  This is done options.warmups times untimed and then options.repetitions
+  times with each phase timed separately. `multi` is true for multi-pattern
+  engines, which make a single pass over the data for all the patterns and
+  whose mismatches are reported sequence by sequence.
+
+  With options.perf, hardware counters are opened on each thread of the pool
+  and are counting only while the timed repetitions search. If `events` is
+  given, the counts for one search are put there, with -1 for any that were
+  not counted (and for all of them without options.perf).
+
+  The return value is the number of mismatches.
+*/
+template <typename Compile, typename Search>
+int run_timed(std::string const &name, Experiment const &data,
+              RunOptions const &options, double load_time, bool multi,
+              Compile compile, Search search,
+              std::array<double, PERF_COUNTERS> *events = nullptr) {
+  WorkPool pool{options.threads};
+  MatchTable results{data.patterns.size() * k_count(data),
+                     data.sequences.size(), !data.answers.empty()};
+  std::vector<PhaseTimes> times;
+  std::vector<Mismatch> mismatches;
+
+  // The counters have to be opened by the thread they count.
+  std::vector<std::unique_ptr<PerfCounters>> counters;
+  if (options.perf) {
+    for (int thread = 0; thread < pool.size(); thread++)
+      counters.push_back(std::make_unique<PerfCounters>());
+    pool.on_each([&](int thread) { counters[thread]->open(); });
+  }
+
+  for (int rep = -options.warmups; rep < options.repetitions; rep++) {
+    double start_time = get_time();
+    auto pat_data = compile(pool);
+    double compiled_time = get_time();
+    if (rep >= 0)
+      for (auto &counter : counters)
+        counter->enable();
+    search(pat_data, pool, results);
+    if (rep >= 0)
+      for (auto &counter : counters)
+        counter->disable();
+    double searched_time = get_time();
+    mismatches = verify_results(data, results, multi);
+    double end_time = get_time();
+
+    if (rep >= 0)
+      times.push_back({compiled_time - start_time,
+                       searched_time - compiled_time,
+                       end_time - searched_time});
+  }
+
+  report_mismatches(mismatches);
+  report_run(name, data, options, pool.size(), load_time, times,
+             multi ? 1 : data.patterns.size());
+  std::array<double, PERF_COUNTERS> counts;
+  counts.fill(-1);
+  if (options.perf)
+    counts = report_counters(counters, options.repetitions);
+  if (events != nullptr)
+    *events = counts;
+
+  return mismatches.size();
+}
+
+/*
+  Pre-process every pattern for a single-pattern engine. `init` compiles one
+  pattern (it is where run() and run_approx() differ).
+*/
+template <typename Engine, typename Init>
+std::vector<typename Engine::Compiled> compile_patterns(Experiment const &data,
+                                                        Init init) {
+  std::vector<typename Engine::Compiled> pat_data;
+  pat_data.reserve(data.patterns.size());
+  for (auto const &pattern : data.patterns)
+    pat_data.push_back(init(pattern));
+
+  return pat_data;
+}
+
+/*
+  The matching loop shared by the single-pattern runners: search every
+  sequence for every compiled pattern. `search` is called with the thread,
+  the pattern and the sequence, and fills in the results for that pair.
+
+  Untiled, this goes pattern by pattern, spreading the sequences over the
+  pool. Tiled, each tile of sequences is one unit of work for the pool: all
+  the patterns are run over it while it is still in cache.
+*/
+template <typename Search>
+void search_patterns(Experiment const &data,
+                     std::vector<std::size_t> const &tiles, WorkPool &pool,
+                     Search search) {
+  int sequences_count = data.sequences.size();
+  int patterns_count = data.patterns.size();
+
+  if (tiles.empty()) {
+    for (int pattern = 0; pattern < patterns_count; pattern++)
+      pool.parallel_for(
+          sequences_count, SEQUENCE_BLOCK,
+          [&](int thread, std::size_t begin, std::size_t end) {
+            for (int sequence = begin; sequence < (int)end; sequence++)
+              search(thread, pattern, sequence);
+          });
+  } else {
+    pool.parallel_for(
+        tiles.size() - 1, 1, [&](int thread, std::size_t tile, std::size_t) {
+          for (int pattern = 0; pattern < patterns_count; pattern++)
+            for (int sequence = tiles[tile]; sequence < (int)tiles[tile + 1];
+                 sequence++)
+              search(thread, pattern, sequence);
+        });
+  }
+}
+
+/*
+  The search of one pair for search_patterns(), for the usual case of one
+  count per pair.
+*/
+template <typename Engine>
+auto count_matches(Experiment const &data,
+                   std::vector<typename Engine::Compiled> const &pat_data,
+                   MatchTable &results) {
+  return [&](int, int pattern, int sequence) {
+    results.set(pattern, sequence,
+                Engine::search(pat_data[pattern], data.sequences[sequence]));
+  };
+}
+
+/*
+  The same, when the experiment is for every k at once. The counts by the
+  smallest k each match needs are summed into a result for each k. Each
+  thread has a buffer of its own for the counts.
+*/
+template <typename Engine>
+auto count_all_k(Experiment const &data,
+                 std::vector<typename Engine::Compiled> const &pat_data,
+                 WorkPool &pool, MatchTable &results) {
+  int k = data.k;
+  int patterns_count = data.patterns.size();
+  std::vector<std::vector<int>> counts(pool.size(), std::vector<int>(k + 1));
+
+  return [&, k, patterns_count, counts = std::move(counts)](
+             int thread, int pattern, int sequence) mutable {
+    auto &gaps = counts[thread];
+    gaps.assign(k + 1, 0);
+    Engine::search_gaps(pat_data[pattern], data.sequences[sequence],
+                        gaps.data());
+    int total = gaps[0];
+    for (int j = 1; j <= k; j++) {
+      total += gaps[j];
+      results.set((j - 1) * patterns_count + pattern, sequence, total);
+    }
+  };
+}
+
+/*
+  Write the position of every match to the file named by options.positions,
+  if there is one. `search` is given a thread pool and a sink for each of its
+  threads, and runs the reporting search over all of the data.
+*/
+template <typename Search>
+void write_positions(RunOptions const &options, Search search) {
+  PositionFile file{options.positions};
+  WorkPool pool{options.threads};
+  std::vector<std::unique_ptr<BufferedSink>> sinks;
+  for (int thread = 0; thread < pool.size(); thread++)
+    sinks.push_back(std::make_unique<BufferedSink>(file));
+
+  double start_time = get_time();
+  search(pool, sinks);
+  for (auto &sink : sinks)
+    sink->flush();
+  report_positions(file.size(), get_time() - start_time);
+}
+
+/*
+  Asking for the positions from an engine that cannot report them is an
+  error, caught before anything is run.
+*/
+template <typename Engine>
+void check_positions(std::string const &name, RunOptions const &options) {
+  if (!options.positions.empty() && !ReportsPositions<Engine>)
+    throw std::runtime_error{name + " cannot report match positions"};
+}
+
+/*
+  The same goes for counting the matches for every k at once.
+*/
+template <typename Engine>
+void check_all_k(std::string const &name, Experiment const &data) {
+  if (data.all_k && !AllGapsEngine<Engine>)
+    throw std::runtime_error{name + " cannot count matches for every k"};
+}
+
+/*
+  The reporting search for the single-pattern runners: every pattern against
+  every sequence, pattern by pattern, with the matches going to the sink for
+  the thread that finds them.
+*/
+template <typename Engine>
+void search_positions(Experiment const &data,
+                      std::vector<typename Engine::Compiled> const &pat_data,
+                      WorkPool &pool,
+                      std::vector<std::unique_ptr<BufferedSink>> &sinks) {
+  int sequences_count = data.sequences.size();
+  int patterns_count = data.patterns.size();
+
+  for (int pattern = 0; pattern < patterns_count; pattern++)
+    pool.parallel_for(
+        sequences_count, SEQUENCE_BLOCK,
+        [&](int thread, std::size_t begin, std::size_t end) {
+          BufferedSink &sink = *sinks[thread];
+          for (int sequence = begin; sequence < (int)end; sequence++)
+            Engine::search(pat_data[pattern], data.sequences[sequence],
+                           [&](std::size_t offset) {
+                             sink.match(pattern, sequence, offset);
+                           });
+        });
+}
+
+/*
+  Run an experiment whose data has already been loaded, over a single-pattern
+  engine. This is the part of run() that follows the parsing of the command
+  line, and is also what the combined binary calls for each engine it runs.
+*/
+template <PatternEngine Engine>
+int run_experiment(std::string const &name, Experiment const &data,
+                   RunOptions const &options, double load_time) {
+  check_positions<Engine>(name, options);
+  std::vector<std::size_t> tiles;
+  if (options.tile_bytes)
+    tiles = make_tiles(data.sequences, options.tile_bytes);
+  auto compile = [&](WorkPool &) {
+    return compile_patterns<Engine>(
+        data, [](std::string_view pattern) { return Engine::init(pattern); });
+  };
+
+  // Run it. Each pattern is searched for in each sequence, and the number of
+  // matches found is compared to the table of answers for that pattern.
+  std::array<double, PERF_COUNTERS> events;
+  int return_code = run_timed(
+      name, data, options, load_time, false, compile,
+      [&](auto const &pat_data, WorkPool &pool, MatchTable &results) {
+        search_patterns(data, tiles, pool,
+                        count_matches<Engine>(data, pat_data, results));
+      },
+      &events);
+  if (options.tile_bytes)
+    report_tiling(options, tiles.size() - 1, data.sequences,
+                  data.patterns.size(), events);
+
+  if constexpr (ReportsPositions<Engine>)
+    if (!options.positions.empty())
+      write_positions(options, [&](WorkPool &pool, auto &sinks) {
+        search_positions<Engine>(data, compile(pool), pool, sinks);
+      });
+
+  return return_code;
+}
+
+/*
+  The part of running an experiment that is shared by the multi-pattern
+  engines, exact and approximate. These always make a single pass over the
+  data, so any tile size in the options is ignored. `compile` pre-processes
+  all of the patterns together.
+*/
+template <typename Engine, typename Compile>
+int run_multi_experiment(std::string const &name, Experiment const &data,
+                         RunOptions const &options, double load_time,
+                         Compile compile) {
+  check_positions<Engine>(name, options);
+  check_all_k<Engine>(name, data);
+  int sequences_count = data.sequences.size();
+  int patterns_count = data.patterns.size();
+
+  // Run it. All the patterns are pre-processed together, and then each
+  // sequence is searched for all of them at once. The number of matches found
+  // for each pattern is compared to the table of answers.
+  int return_code = run_timed(
+      name, data, options, load_time, true, compile,
+      [&](auto const &pat_data, WorkPool &pool, MatchTable &results) {
+        pool.parallel_for(
+            sequences_count, SEQUENCE_BLOCK,
+            [&](int, std::size_t begin, std::size_t end) {
+              if constexpr (BlockSearchEngine<Engine>) {
+                Engine::search_block(pat_data, data.sequences, begin, end,
+                                     results);
+                return;
+              }
+              for (int sequence = begin; sequence < (int)end; sequence++) {
+                std::vector<int> matches =
+                    Engine::search(pat_data, data.sequences[sequence]);
+
+                for (int pattern = 0; pattern < patterns_count; pattern++)
+                  results.set(pattern, sequence, matches[pattern]);
+              }
+            });
+      });
+
+  // The positions, if asked for, in one more pass over the sequences.
+  if constexpr (ReportsPositions<Engine>)
+    if (!options.positions.empty())
+      write_positions(options, [&](WorkPool &pool, auto &sinks) {
+        auto pat_data = compile(pool);
+        pool.parallel_for(
+            sequences_count, SEQUENCE_BLOCK,
+            [&](int thread, std::size_t begin, std::size_t end) {
+              BufferedSink &sink = *sinks[thread];
+              for (int sequence = begin; sequence < (int)end; sequence++)
+                Engine::search(pat_data, data.sequences[sequence],
+                               [&](int pattern, std::size_t offset) {
+                                 sink.match(pattern, sequence, offset);
+                               });
+            });
+      });
+
+  return return_code;
+}
+
+/*
+  The same, for a multi-pattern engine.
+*/
+template <MultiPatternEngine Engine>
+int run_experiment(std::string const &name, Experiment const &data,
+                   RunOptions const &options, double load_time) {
+  auto compile = [&](WorkPool &pool) {
+    std::vector<std::string_view> patterns{data.patterns.begin(),
+                                           data.patterns.end()};
+    if constexpr (PoolInitEngine<Engine>)
+      return Engine::init(patterns, pool);
+    else
+      return Engine::init(patterns);
+  };
+
+  return run_multi_experiment<Engine>(name, data, options, load_time,
+                                      compile);
+}
+
+/*
+  The same, for an approximate-matching engine. The value of k is data.k, and
+  with data.all_k, each search counts the matches for all of the values up to
+  that.
+*/
+template <ApproxEngine Engine>
+int run_experiment(std::string const &name, Experiment const &data,
+                   RunOptions const &options, double load_time) {
+  check_positions<Engine>(name, options);
+  check_all_k<Engine>(name, data);
+  std::vector<std::size_t> tiles;
+  if (options.tile_bytes)
+    tiles = make_tiles(data.sequences, options.tile_bytes);
+  int k = data.k;
+  auto compile = [&](WorkPool &) {
+    return compile_patterns<Engine>(data, [k](std::string_view pattern) {
+      return Engine::init(pattern, k);
+    });
+  };
+
+  // Run it, as for a single-pattern engine.
+  std::array<double, PERF_COUNTERS> events;
+  int return_code = run_timed(
+      name, data, options, load_time, false, compile,
+      [&](auto const &pat_data, WorkPool &pool, MatchTable &results) {
+        if constexpr (AllGapsEngine<Engine>)
+          if (data.all_k) {
+            search_patterns(
+                data, tiles, pool,
+                count_all_k<Engine>(data, pat_data, pool, results));
+            return;
+          }
+        search_patterns(data, tiles, pool,
+                        count_matches<Engine>(data, pat_data, results));
+      },
+      &events);
+  if (options.tile_bytes)
+    report_tiling(options, tiles.size() - 1, data.sequences,
+                  data.patterns.size(), events);
+
+  if constexpr (ReportsPositions<Engine>)
+    if (!options.positions.empty())
+      write_positions(options, [&](WorkPool &pool, auto &sinks) {
+        search_positions<Engine>(data, compile(pool), pool, sinks);
+      });
+
+  return return_code;
+}
+
+/*
+  The same, for a multi-pattern approximate-matching engine. All of the
+  patterns are compiled together for k = data.k, and searched for in a single
+  pass over the data, as for a multi-pattern engine.
+*/
+template <MultiApproxEngine Engine>
+int run_experiment(std::string const &name, Experiment const &data,
+                   RunOptions const &options, double load_time) {
+  int k = data.k;
+  auto compile = [&](WorkPool &) {
+    std::vector<std::string_view> patterns{data.patterns.begin(),
+                                           data.patterns.end()};
+    return Engine::init(patterns, k);
+  };
+
+  return run_multi_experiment<Engine>(name, data, options, load_time,
+                                      compile);
+}
+
+/*
+  The "runner" function. This takes the algorithm as the template parameter,
+  and the name of the algorithm, argc and argv from the invocation, and runs
+  the experiment over the given algorithm.
+
+  The return value is 0 if the experiment correctly identified all pattern
+  instances in all sequences, and the number of misses otherwise. An exception
+  is thrown on non-recoverable errors.
+*/
+template <PatternEngine Engine>
+int run(std::string name, int argc, char *argv[]) {
+  RunOptions options;
+  int arg = parse_options(argc, argv, true, 2, 3,
+                          "<sequences> <patterns> [ <answers> ]", options);
+
+  // Read the three data files. Any of these that encounter an error will
+  // throw an exception. The filenames are in the order: sequences patterns
+  // answers.
+  double start_time = get_time();
+  Experiment data =
+      load_experiment(argv[arg], argv[arg + 1],
+                      argc - arg == 3 ? argv[arg + 2] : nullptr, -1,
+                      options.all_k);
+  double load_time = get_time() - start_time;
+
+  return run_experiment<Engine>(name, data, options, load_time);
+}
+
+/*
+  This is a variation of "run" that handles algorithms that do multi-pattern
+  matching.
+*/
+template <MultiPatternEngine Engine>
+int run_multi(std::string name, int argc, char *argv[]) {
+  RunOptions options;
+  int arg = parse_options(argc, argv, false, 2, 3,
+                          "<sequences> <patterns> [ <answers> ]", options);
+
+  // Read the three data files. Any of these that encounter an error will
+  // throw an exception. The filenames are in the order: sequences patterns
+  // answers.
+  double start_time = get_time();
+  Experiment data =
+      load_experiment(argv[arg], argv[arg + 1],
+                      argc - arg == 3 ? argv[arg + 2] : nullptr, -1,
+                      options.all_k);
+  double load_time = get_time() - start_time;
+
+  return run_experiment<Engine>(name, data, options, load_time);
+}
+
+/*
+  This is a variation of "run" for approximate matching, where the first
+  argument is the value of k and the answers filename has a %d in it that is
+  filled in with k.
+*/
+template <ApproxEngine Engine>
+int run_approx(std::string name, int argc, char *argv[]) {
+  RunOptions options;
+  int arg = parse_options(argc, argv, true, 3, 4,
+                          "<k> <sequences> <patterns> [ <answers> ]", options);
+
+  // Read the initial integer and three data files. Any of these that encounter
+  // an error will throw an exception. The filenames are in the order: sequences
+  // patterns answers.
+  int k = std::stoi(argv[arg]);
+  double start_time = get_time();
+  Experiment data =
+      load_experiment(argv[arg + 1], argv[arg + 2],
+                      argc - arg == 4 ? argv[arg + 3] : nullptr, k,
+                      options.all_k);
+  double load_time = get_time() - start_time;
+
+  return run_experiment<Engine>(name, data, options, load_time);
+}
+
+/*
+  This is a variation of "run_approx" that handles algorithms that do multi-
+  pattern approximate matching. The arguments are the same as for
+  run_approx().
+*/
+template <MultiApproxEngine Engine>
+int run_multi_approx(std::string name, int argc, char *argv[]) {
+  RunOptions options;
+  int arg = parse_options(argc, argv, false, 3, 4,
+                          "<k> <sequences> <patterns> [ <answers> ]", options);
+
+  // Read the initial integer and three data files. Any of these that encounter
+  // an error will throw an exception. The filenames are in the order: sequences
+  // patterns answers.
+  int k = std::stoi(argv[arg]);
+  double start_time = get_time();
+  Experiment data =
+      load_experiment(argv[arg + 1], argv[arg + 2],
+                      argc - arg == 4 ? argv[arg + 3] : nullptr, k,
+                      options.all_k);
+  double load_time = get_time() - start_time;
+
+  return run_experiment<Engine>(name, data, options, load_time);
+}
+
+/*
+  Search every sequence for a batch of patterns, filling in `results`. This is
+  the query path of the server (server.cpp), so there is no timing or checking
+  here. The batch is worked through sequence by sequence, each sequence being
+  searched for all of the patterns while it is in cache. `k` is only used by
+  approximate engines.
+*/
+template <PatternEngine Engine>
+void search_batch(std::vector<std::string_view> const &patterns, int,
+                  SequenceData const &sequences, WorkPool &pool,
+                  MatchTable &results) {
+  std::vector<typename Engine::Compiled> pat_data;
+  for (auto const &pattern : patterns)
+    pat_data.push_back(Engine::init(pattern));
+
+  int patterns_count = pat_data.size();
+  pool.parallel_for(
+      sequences.size(), SEQUENCE_BLOCK,
+      [&](int, std::size_t begin, std::size_t end) {
+        for (int sequence = begin; sequence < (int)end; sequence++)
+          for (int pattern = 0; pattern < patterns_count; pattern++)
+            results.set(pattern, sequence,
+                        Engine::search(pat_data[pattern], sequences[sequence]));
+      });
+}
+
+/*
+  The query path shared by the multi-pattern engines, once the patterns have
+  been compiled: a single pass over the sequences.
+*/
+template <typename Engine>
+void search_multi_batch(typename Engine::Compiled const &pat_data,
+                        int patterns_count, SequenceData const &sequences,
+                        WorkPool &pool, MatchTable &results) {
+  pool.parallel_for(
+      sequences.size(), SEQUENCE_BLOCK,
+      [&](int, std::size_t begin, std::size_t end) {
+        if constexpr (BlockSearchEngine<Engine>) {
+          Engine::search_block(pat_data, sequences, begin, end, results);
+          return;
+        }
+        for (int sequence = begin; sequence < (int)end; sequence++) {
+          std::vector<int> matches =
+              Engine::search(pat_data, sequences[sequence]);
+
+          for (int pattern = 0; pattern < patterns_count; pattern++)
+            results.set(pattern, sequence, matches[pattern]);
+        }
+      });
+}
+
+template <MultiPatternEngine Engine>
+void search_batch(std::vector<std::string_view> const &patterns, int,
+                  SequenceData const &sequences, WorkPool &pool,
+                  MatchTable &results) {
+  auto pat_data = [&] {
+    if constexpr (PoolInitEngine<Engine>)
+      return Engine::init(patterns, pool);
+    else
+      return Engine::init(patterns);
+  }();
+
+  search_multi_batch<Engine>(pat_data, patterns.size(), sequences, pool,
+                             results);
+}
+
+template <ApproxEngine Engine>
+void search_batch(std::vector<std::string_view> const &patterns, int k,
+                  SequenceData const &sequences, WorkPool &pool,
+                  MatchTable &results) {
+  std::vector<typename Engine::Compiled> pat_data;
+  for (auto const &pattern : patterns)
+    pat_data.push_back(Engine::init(pattern, k));
+
+  int patterns_count = pat_data.size();
+  pool.parallel_for(
+      sequences.size(), SEQUENCE_BLOCK,
+      [&](int, std::size_t begin, std::size_t end) {
+        for (int sequence = begin; sequence < (int)end; sequence++)
+          for (int pattern = 0; pattern < patterns_count; pattern++)
+            results.set(pattern, sequence,
+                        Engine::search(pat_data[pattern], sequences[sequence]));
+      });
+}
+
+template <MultiApproxEngine Engine>
+void search_batch(std::vector<std::string_view> const &patterns, int k,
+                  SequenceData const &sequences, WorkPool &pool,
+                  MatchTable &results) {
+  search_multi_batch<Engine>(Engine::init(patterns, k), patterns.size(),
+                             sequences, pool, results);
+}
+
+/*
+  The registry of engines, from which the combined binary (engines.cpp) and
+  the server (server.cpp) pick the ones to run by name. Each engine's source
+  file adds itself with a static RegisterEngine object, so linking the file in
+  is all it takes.
+*/
+struct RegisteredEngine {
+  std::string name;
+  // Whether the engine does approximate matching, and so needs a k.
+  bool approx;
+  int (*run)(std::string const &name, Experiment const &data,
+             RunOptions const &options, double load_time);
+  void (*search)(std::vector<std::string_view> const &patterns, int k,
+                 SequenceData const &sequences, WorkPool &pool,
+                 MatchTable &results);
+};
+
+extern std::vector<RegisteredEngine> &engine_registry();
+
+template <typename Engine> struct RegisterEngine {
+  explicit RegisterEngine(std::string const &name) {
+    engine_registry().push_back(
+        {name, ApproxEngine<Engine> || MultiApproxEngine<Engine>,
+         &run_experiment<Engine>,
+         &search_batch<Engine>});
+  }
+};
 
 #endif // !_RUN_HPP
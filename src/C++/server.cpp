@@ -0,0 +1,427 @@
+/*
+  The query server. This loads a set of sequences once and keeps them in
+  memory, then answers queries against them for as long as it runs. Each query
+  names an engine, the value of k (for approximate engines only) and a
+  pattern, and the answer is the number of matches in each of the sequences.
+
+  Queries are read from standard input, or from connections to a Unix domain
+  socket if one is given with -s. They are one to a line:
+
+    <engine> <pattern>
+    <engine> <k> <pattern>
+
+  and each gets back a line of its own, in the order they were asked on that
+  input:
+
+    ok <latency> <count> <count> ...
+    error <message>
+
+  where latency is the time in seconds from the query being read to its reply
+  being ready.
+
+  Queries are answered in batches of whatever is waiting when the last batch
+  is done (up to the -n limit). The queries in a batch for the same engine and
+  k are searched for together, over the thread pool, in one pass over the
+  sequences. At the end of standard input, the latency statistics over all of
+  the queries are written to stderr.
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "input.hpp"
+#include "pool.hpp"
+#include "run.hpp"
+
+// The most queries that are answered in one batch, unless -n says otherwise.
+constexpr std::size_t DEFAULT_BATCH = 64;
+
+/*
+  Where queries come from and replies go: standard input and output, or one
+  connection to the socket (which is closed when the last reference to it
+  goes, once it has been read to the end and everything asked on it has been
+  answered).
+*/
+struct Connection {
+  Connection(int in, int out) : in{in}, out{out} {}
+  Connection(Connection const &) = delete;
+  Connection &operator=(Connection const &) = delete;
+  ~Connection() {
+    if (in != STDIN_FILENO)
+      close(in);
+  }
+
+  int in;
+  int out;
+};
+
+/*
+  One query. If it could not be parsed, `error` says why and it is not
+  searched for.
+*/
+struct Query {
+  std::shared_ptr<Connection> connection;
+  RegisteredEngine const *engine = nullptr;
+  int k = -1;
+  std::string pattern;
+  std::string error;
+  // When the query was read, for its latency.
+  double received;
+};
+
+/*
+  The queries waiting to be answered. The readers add to it, and the main
+  thread takes them off in batches.
+*/
+class QueryQueue {
+public:
+  void push(Query query) {
+    {
+      std::lock_guard<std::mutex> guard{lock};
+      queries.push_back(std::move(query));
+    }
+    ready.notify_one();
+  }
+
+  // No more queries will come.
+  void close() {
+    {
+      std::lock_guard<std::mutex> guard{lock};
+      closed = true;
+    }
+    ready.notify_one();
+  }
+
+  // Wait for there to be queries, and take up to `max` of them. An empty
+  // batch means that the queue is closed and there are no more.
+  std::vector<Query> take(std::size_t max) {
+    std::unique_lock<std::mutex> guard{lock};
+    ready.wait(guard, [this] { return closed || !queries.empty(); });
+
+    std::vector<Query> batch;
+    while (!queries.empty() && batch.size() < max) {
+      batch.push_back(std::move(queries.front()));
+      queries.pop_front();
+    }
+
+    return batch;
+  }
+
+private:
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<Query> queries;
+  bool closed = false;
+};
+
+/*
+  Parse one line of input into a query. A value of k above `max_k`, the
+  length of the longest sequence, is taken down to that: no gap can be any
+  longer, so the matches are the same, and the engines are not asked to build
+  tables for gaps that cannot happen.
+*/
+Query parse_query(std::string const &line, int max_k) {
+  Query query;
+  query.received = get_time();
+
+  std::istringstream fields{line};
+  std::string name, k, extra;
+  fields >> name;
+  for (auto const &engine : engine_registry())
+    if (engine.name == name)
+      query.engine = &engine;
+  if (query.engine == nullptr) {
+    query.error = "unknown engine \"" + name + "\"";
+    return query;
+  }
+
+  if (query.engine->approx) {
+    fields >> k;
+    try {
+      query.k = std::stoi(k);
+    } catch (std::exception const &) {
+      query.k = -1;
+    }
+    if (query.k < 0) {
+      query.error = "bad value of k \"" + k + "\"";
+      return query;
+    }
+    query.k = std::min(query.k, max_k);
+  }
+
+  fields >> query.pattern;
+  if (query.pattern.empty())
+    query.error = "no pattern given";
+  else if (fields >> extra)
+    query.error = "unexpected \"" + extra + "\" after the pattern";
+  // The fields are split at whitespace, so only control characters and
+  // non-ASCII need checking for.
+  for (unsigned char c : query.pattern)
+    if (c < ' ' || c > '~')
+      query.error = "pattern is not printable ASCII";
+
+  return query;
+}
+
+/*
+  Read lines from a connection until it reaches end of file, queueing up a
+  query for each one. Empty lines are skipped. A last line with no newline at
+  the end is still a query.
+*/
+void read_queries(std::shared_ptr<Connection> connection, QueryQueue &queue,
+                  int max_k) {
+  std::string buffer;
+  char chunk[4096];
+  ssize_t got;
+
+  auto take = [&](std::string const &line) {
+    if (line.empty())
+      return;
+    Query query = parse_query(line, max_k);
+    query.connection = connection;
+    queue.push(std::move(query));
+  };
+
+  while ((got = read(connection->in, chunk, sizeof chunk)) > 0) {
+    buffer.append(chunk, got);
+
+    std::size_t start = 0, newline;
+    while ((newline = buffer.find('\n', start)) != std::string::npos) {
+      take(buffer.substr(start, newline - start));
+      start = newline + 1;
+    }
+    buffer.erase(0, start);
+  }
+  take(buffer);
+}
+
+/*
+  Write all of `text`, giving up quietly if the other end has gone away.
+*/
+void write_all(int fd, std::string const &text) {
+  std::size_t done = 0;
+
+  while (done < text.size()) {
+    ssize_t wrote = write(fd, text.data() + done, text.size() - done);
+    if (wrote < 0 && errno == EINTR)
+      continue;
+    if (wrote <= 0)
+      return;
+    done += wrote;
+  }
+}
+
+/*
+  Search for a group of queries that share an engine and k, all together, and
+  fill in their replies. If any pattern is rejected by the engine, the queries
+  are retried one by one so that only the bad one gets an error.
+*/
+void answer_group(std::vector<Query> const &batch,
+                  std::vector<std::size_t> const &group,
+                  SequenceData const &sequences, WorkPool &pool,
+                  std::vector<std::string> &replies,
+                  std::vector<double> &latencies) {
+  RegisteredEngine const *engine = batch[group.front()].engine;
+  int k = batch[group.front()].k;
+
+  std::vector<std::string_view> patterns;
+  for (std::size_t idx : group)
+    patterns.push_back(batch[idx].pattern);
+  MatchTable results{patterns.size(), sequences.size()};
+
+  try {
+    engine->search(patterns, k, sequences, pool, results);
+  } catch (std::exception const &error) {
+    if (group.size() == 1)
+      replies[group.front()] = std::string{"error "} + error.what();
+    else
+      for (std::size_t idx : group)
+        answer_group(batch, {idx}, sequences, pool, replies, latencies);
+    return;
+  }
+
+  for (std::size_t pattern = 0; pattern < group.size(); pattern++) {
+    double latency = get_time() - batch[group[pattern]].received;
+    latencies.push_back(latency);
+
+    std::ostringstream reply;
+    reply << "ok " << latency;
+    for (std::size_t sequence = 0; sequence < sequences.size(); sequence++)
+      reply << " " << results(pattern, sequence);
+    replies[group[pattern]] = reply.str();
+  }
+}
+
+/*
+  Answer a batch of queries, and send the replies back in the order the
+  queries were taken, which keeps them in order for each connection.
+*/
+void answer_batch(std::vector<Query> const &batch,
+                  SequenceData const &sequences, WorkPool &pool,
+                  std::vector<double> &latencies) {
+  std::vector<std::string> replies(batch.size());
+  std::vector<bool> grouped(batch.size(), false);
+
+  for (std::size_t first = 0; first < batch.size(); first++) {
+    if (grouped[first])
+      continue;
+    if (!batch[first].error.empty()) {
+      replies[first] = "error " + batch[first].error;
+      continue;
+    }
+
+    std::vector<std::size_t> group;
+    for (std::size_t idx = first; idx < batch.size(); idx++)
+      if (!grouped[idx] && batch[idx].error.empty() &&
+          batch[idx].engine == batch[first].engine &&
+          batch[idx].k == batch[first].k) {
+        group.push_back(idx);
+        grouped[idx] = true;
+      }
+    answer_group(batch, group, sequences, pool, replies, latencies);
+  }
+
+  for (std::size_t idx = 0; idx < batch.size(); idx++)
+    write_all(batch[idx].connection->out, replies[idx] + "\n");
+}
+
+/*
+  Create the socket at `path` (replacing any that was left behind by an
+  earlier server) and start listening on it.
+*/
+int listen_socket(char const *path) {
+  struct sockaddr_un address;
+  std::memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof address.sun_path)
+    throw std::runtime_error{"Socket path is too long"};
+  std::strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof address) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    std::ostringstream error;
+    error << "Error listening on " << path << ": " << std::strerror(errno);
+    throw std::runtime_error{error.str()};
+  }
+
+  return fd;
+}
+
+/*
+  Accept connections for as long as the server runs, with a reader thread for
+  each.
+*/
+void accept_connections(int listener, QueryQueue &queue, int max_k) {
+  for (;;) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      std::cerr << "Error accepting connection: " << std::strerror(errno)
+                << "\n";
+      return;
+    }
+
+    auto connection = std::make_shared<Connection>(fd, fd);
+    std::thread{read_queries, connection, std::ref(queue), max_k}.detach();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int threads = 1;
+  std::size_t batch_size = DEFAULT_BATCH;
+  char const *socket_path = nullptr;
+  int opt;
+  bool ok = true;
+
+  while ((opt = getopt(argc, argv, "t:s:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      threads = std::stoi(optarg);
+      if (threads < 1)
+        ok = false;
+      break;
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'n':
+      batch_size = std::stoul(optarg);
+      if (batch_size == 0)
+        ok = false;
+      break;
+    default:
+      ok = false;
+      break;
+    }
+  }
+  if (!ok || argc - optind != 1) {
+    std::ostringstream error;
+    error << "Usage: " << argv[0] << " [ -t <threads> ] [ -s <socket> ] "
+          << "[ -n <batch> ] <sequences>";
+    throw std::runtime_error{error.str()};
+  }
+
+  double start_time = get_time();
+  SequenceData sequences = map_sequences(argv[optind]);
+  std::cerr << "Loaded " << sequences.size() << " sequences in "
+            << get_time() - start_time << " seconds\n";
+  int max_k = 0;
+  for (auto const &sequence : sequences)
+    max_k = std::max<int>(max_k, sequence.length());
+
+  // A client that goes away before its replies are written should not take
+  // the server down with it.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  WorkPool pool{threads};
+  QueryQueue queue;
+  std::thread reader;
+  if (socket_path != nullptr) {
+    int listener = listen_socket(socket_path);
+    reader =
+        std::thread{accept_connections, listener, std::ref(queue), max_k};
+  } else {
+    reader = std::thread{[&queue, max_k] {
+      read_queries(
+          std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO), queue,
+          max_k);
+      queue.close();
+    }};
+  }
+
+  // Each batch is let go of before waiting for the next, which closes any
+  // connection that has nothing more to come.
+  std::vector<double> latencies;
+  for (;;) {
+    std::vector<Query> batch = queue.take(batch_size);
+    if (batch.empty())
+      break;
+    answer_batch(batch, sequences, pool, latencies);
+  }
+  reader.join();
+
+  if (!latencies.empty())
+    std::cerr << "queries: " << latencies.size() << "\n"
+              << "latency: " << summarize(latencies) << "\n";
+
+  return 0;
+}
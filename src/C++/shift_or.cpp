@@ -8,6 +8,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "run.hpp"
@@ -28,7 +29,7 @@ typedef unsigned long WORD_TYPE;
   Preprocessing step: Calculate the positions of each character of the
   alphabet within the pattern `pat`.
 */
-WORD_TYPE calc_s_positions(std::string const &pat, int m,
+WORD_TYPE calc_s_positions(std::string_view pat, int m,
                            std::vector<WORD_TYPE> &s_positions) {
   WORD_TYPE j, lim;
   int i;
@@ -42,7 +43,17 @@ WORD_TYPE calc_s_positions(std::string const &pat, int m,
   return lim;
 }
 
-std::vector<PatternData> init_shift_or(std::string const &pattern) {
+/*
+  The pre-processed form of a pattern, as used by shift_or().
+*/
+struct ShiftOrPattern {
+  WORD_TYPE lim;
+  std::vector<WORD_TYPE> s_positions;
+  // Only needed to turn the end of a match into its start.
+  int m;
+};
+
+ShiftOrPattern init_shift_or(std::string_view pattern) {
   int m = pattern.length();
   if (m > WORD) {
     std::ostringstream error;
@@ -50,54 +61,75 @@ std::vector<PatternData> init_shift_or(std::string const &pattern) {
     throw std::runtime_error{error.str()};
   }
 
-  std::vector<PatternData> return_val;
-  return_val.reserve(2);
   // Declare and initialize the s_positions vector:
   std::vector<WORD_TYPE> s_positions(ASIZE, ~0);
 
   /* Preprocessing */
   WORD_TYPE lim = calc_s_positions(pattern, m, s_positions);
 
-  return_val.push_back(lim);
-  return_val.push_back(s_positions);
-
-  return return_val;
+  return {lim, s_positions, m};
 }
 
 /*
   Perform the Shift-Or algorithm on the given pattern of length m, against
-  the sequence of length n.
+  the sequence of length n. `report` is called with the offset of each match.
 */
-int shift_or(std::vector<PatternData> const &pat_data,
-             std::string const &sequence) {
+template <typename Report>
+int shift_or(ShiftOrPattern const &pat_data, std::string_view sequence,
+             Report report) {
   WORD_TYPE state;
   int matches = 0;
   int j;
 
   // Unpack pat_data:
-  WORD_TYPE lim = std::get<WORD_TYPE>(pat_data[0]);
-  auto const &s_positions = std::get<std::vector<WORD_TYPE>>(pat_data[1]);
+  WORD_TYPE lim = pat_data.lim;
+  auto const &s_positions = pat_data.s_positions;
 
-  // Get the size of the sequence. Pattern size is not needed here.
+  // Get the size of the sequence. Pattern size is only needed for reporting.
+  int m = pat_data.m;
   int n = sequence.length();
 
   /* Searching */
   for (state = ~0, j = 0; j < n; ++j) {
     state = (state << 1) | s_positions[sequence[j]];
-    if (state < lim)
+    if (state < lim) {
       matches++;
+      report(j + 1 - m);
+    }
   }
 
   return matches;
 }
 
 /*
-  All that is done here is call the run() function with a pointer to the
-  algorithm implementation, the label for the algorithm, and the argc/argv
-  values.
+  The engine that hands the two functions above to the runner.
+*/
+struct ShiftOr {
+  typedef ShiftOrPattern Compiled;
+  static Compiled init(std::string_view pattern) {
+    return init_shift_or(pattern);
+  }
+  static int search(Compiled const &pat_data, std::string_view sequence) {
+    return shift_or(pat_data, sequence, IgnoreMatch{});
+  }
+  template <typename Report>
+  static int search(Compiled const &pat_data, std::string_view sequence,
+                    Report report) {
+    return shift_or(pat_data, sequence, report);
+  }
+};
+
+// Make the engine available to the combined binary as well.
+static RegisterEngine<ShiftOr> registration{"shift_or"};
+
+#ifndef MULTI_ENGINE
+/*
+  All that is done here is call the run() function with the algorithm's
+  engine, the label for the algorithm, and the argc/argv values.
 */
 int main(int argc, char *argv[]) {
-  int return_code = run(&init_shift_or, &shift_or, "shift_or", argc, argv);
+  int return_code = run<ShiftOr>("shift_or", argc, argv);
 
   return return_code;
 }
+#endif // !MULTI_ENGINE
@@ -0,0 +1,62 @@
+/*
+  The file side of the writing of match positions. The buffering is all in
+  sink.hpp, so that it is inlined into the search loops.
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#include "sink.hpp"
+
+static_assert(sizeof(PositionRecord) == 12, "PositionRecord must be packed");
+
+/*
+  Throw an exception for a failed system call on the positions file.
+*/
+static void file_error(std::string const &action, std::string const &fname) {
+  std::ostringstream error;
+  error << "Error " << action << " " << fname << ": " << std::strerror(errno);
+  throw std::runtime_error{error.str()};
+}
+
+/*
+  Create (or truncate) the file, and write the magic number.
+*/
+PositionFile::PositionFile(std::string const &fname) : fname{fname} {
+  fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    file_error("opening", fname);
+  if (::write(fd, POSITIONS_MAGIC, 4) != 4) {
+    close(fd);
+    file_error("writing", fname);
+  }
+}
+
+PositionFile::~PositionFile() { close(fd); }
+
+/*
+  Append a buffer of records. The records are written as they are in memory,
+  which is the file's little-endian layout on the machines this runs on.
+*/
+void PositionFile::write(PositionRecord const *records, std::size_t count) {
+  std::lock_guard<std::mutex> guard{lock};
+  char const *data = (char const *)records;
+  std::size_t bytes = count * sizeof(PositionRecord);
+
+  while (bytes > 0) {
+    ssize_t wrote = ::write(fd, data, bytes);
+    if (wrote < 0 && errno == EINTR)
+      continue;
+    if (wrote <= 0)
+      file_error("writing", fname);
+    data += wrote;
+    bytes -= wrote;
+  }
+  written += count;
+}
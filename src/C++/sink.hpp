@@ -0,0 +1,83 @@
+/*
+  Header file for the writing of match positions.
+*/
+
+#ifndef _SINK_HPP
+#define _SINK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// The four bytes at the start of a positions file.
+constexpr char POSITIONS_MAGIC[] = "POS1";
+
+/*
+  One match: the index of the pattern and of the sequence (both from 0), and
+  the offset of the start of the match in the sequence.
+*/
+struct PositionRecord {
+  std::uint32_t pattern;
+  std::uint32_t sequence;
+  std::uint32_t offset;
+};
+
+/*
+  A file of match positions. It holds the four characters "POS1" and then the
+  records, each as three little-endian uint32 values in the order of the
+  fields of PositionRecord. Records are added by any number of threads at
+  once, each adding a whole buffer at a time, so with more than one thread
+  they are in no particular order.
+*/
+class PositionFile {
+public:
+  explicit PositionFile(std::string const &fname);
+  PositionFile(PositionFile const &) = delete;
+  PositionFile &operator=(PositionFile const &) = delete;
+  ~PositionFile();
+
+  void write(PositionRecord const *records, std::size_t count);
+  std::size_t size() const { return written; }
+
+private:
+  std::string fname;
+  int fd;
+  std::mutex lock;
+  std::size_t written = 0;
+};
+
+/*
+  A sink for the matches found by one thread. The records are gathered in a
+  fixed buffer and handed to the file whenever it fills up, so that nothing is
+  allocated while searching. Whatever is left at the end has to be flushed
+  explicitly.
+*/
+class BufferedSink {
+public:
+  explicit BufferedSink(PositionFile &file) : file{file} {}
+  BufferedSink(BufferedSink const &) = delete;
+  BufferedSink &operator=(BufferedSink const &) = delete;
+
+  void match(int pattern, int sequence, std::size_t offset) {
+    buffer[used++] = {(std::uint32_t)pattern, (std::uint32_t)sequence,
+                      (std::uint32_t)offset};
+    if (used == BUFFER_RECORDS)
+      flush();
+  }
+
+  void flush() {
+    if (used)
+      file.write(buffer, used);
+    used = 0;
+  }
+
+private:
+  static constexpr std::size_t BUFFER_RECORDS = 4096;
+
+  PositionFile &file;
+  PositionRecord buffer[BUFFER_RECORDS];
+  std::size_t used = 0;
+};
+
+#endif // !_SINK_HPP
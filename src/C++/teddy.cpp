@@ -0,0 +1,486 @@
+/*
+  Implementation of a Teddy-style prefilter for multi-pattern matching.
+
+  This follows the idea of the "Teddy" matcher from Hyperscan: the patterns
+  are split into eight buckets, and a table look-up (a byte shuffle, in the
+  SIMD forms) on the first few characters at each position of the sequence
+  gives a bitmask of the buckets that might have a pattern starting there.
+  Only at the positions where that mask is not 0 are the bucket's patterns
+  compared with the sequence, so most of the search is a run of shuffles and
+  ANDs over 16 or 32 positions at a time.
+
+  With AVX2, there is also the "fat" form from Hyperscan, which has sixteen
+  buckets and does 16 positions at a time: the low half of each 256-bit
+  register is for buckets 0 to 7 and the high half for buckets 8 to 15. With
+  fewer patterns in each bucket, it lets through far fewer positions when
+  there are more than a few dozen patterns.
+
+  Teddy looks up each character by its high and low nibbles. That does not
+  suit DNA: with only four letters, a bucket of more than two or three
+  patterns soon has every letter in every column, and the filter passes
+  everything. Here, each look-up is over a pair of bases instead. A base has
+  a 2-bit code (taken from its low nibble, which is different for each of A,
+  C, G and T), and the codes of two bases side by side make the 4-bit index
+  of the shuffle. The mask for a bucket then says which pairs of bases its
+  patterns have in each column of pairs, which is much tighter. Up to four
+  pairs (eight bases) are looked at, or fewer if a pattern is shorter.
+
+  Any other character is given the code of one of the bases. That can only
+  let through positions that the comparison then throws out, so patterns
+  and sequences with other characters in them are still handled correctly.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEDDY_X86
+#endif
+
+#include "run.hpp"
+
+// The number of buckets: one bit each in a mask byte, or in two for the fat
+// form.
+constexpr int BUCKETS = 8;
+constexpr int FAT_BUCKETS = 16;
+
+// With more patterns than this, the fat form is the faster of the two AVX2
+// forms.
+constexpr int FAT_PATTERNS = 16;
+
+// The most pairs of bases the filter looks at, and so the most bases.
+constexpr int MAX_LANES = 4;
+constexpr int MAX_FINGERPRINT = 2 * MAX_LANES;
+
+// The 2-bit code of a character, by its low nibble: A (0x41) is 0, C (0x43)
+// is 1, G (0x47) is 2 and T (0x54) is 3.
+alignas(16) constexpr std::uint8_t NIBBLE_CODES[16] = {0, 0, 0, 1, 3, 0, 0, 2,
+                                                       0, 0, 0, 0, 0, 0, 0, 0};
+
+inline int base_code(char c) { return NIBBLE_CODES[c & 0x0f]; }
+
+// The forms of the search. Auto is the fastest that the processor has for
+// the number of patterns.
+enum class TeddyPath { Auto, Scalar, Ssse3, Avx2, FatAvx2 };
+
+/*
+  The pre-processed form of the patterns, as used by teddy().
+
+  The filter looks at the first `fingerprint` characters of a position, as
+  `lanes` pairs. Bit b of masks[lane][first * 4 + second] is set if a pattern
+  in bucket b has the bases with codes `first` and `second` as its pair
+  number `lane`, and bit b of masks[lane][16 + first * 4 + second] likewise
+  for bucket 8 + b. Where the pattern ends halfway through the last pair, the
+  bits are set for every second base.
+
+  The buckets are laid out like the Aho-Corasick output function: the
+  patterns of bucket b are bucket_patterns[bucket_offsets[b]] up to
+  bucket_patterns[bucket_offsets[b + 1]]. The text of the patterns is copied,
+  one after the other, into `text`.
+*/
+struct TeddyPatterns {
+  int pattern_count;
+  TeddyPath path;
+  int buckets;
+  int fingerprint;
+  int lanes;
+  std::array<std::array<std::uint8_t, 32>, MAX_LANES> masks;
+  std::vector<int> bucket_offsets;
+  std::vector<int> bucket_patterns;
+  std::string text;
+  std::vector<std::size_t> starts;
+  std::vector<int> lengths;
+};
+
+/*
+  Whether the processor can run the given form of the search.
+*/
+bool teddy_supported(TeddyPath path) {
+  switch (path) {
+#ifdef TEDDY_X86
+  case TeddyPath::Avx2:
+  case TeddyPath::FatAvx2:
+    return __builtin_cpu_supports("avx2");
+  case TeddyPath::Ssse3:
+    return __builtin_cpu_supports("ssse3");
+#endif
+  case TeddyPath::Auto:
+  case TeddyPath::Scalar:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+  Pre-process the patterns. The patterns are sorted before being cut into
+  buckets, so that each bucket holds patterns that start alike, and its masks
+  have as few bits set as they can.
+*/
+TeddyPatterns init_teddy(std::vector<std::string_view> const &patterns_data,
+                         TeddyPath path) {
+  int patterns_count = patterns_data.size();
+
+  if (path == TeddyPath::Auto) {
+    path = TeddyPath::Scalar;
+    if (teddy_supported(TeddyPath::Ssse3))
+      path = TeddyPath::Ssse3;
+    if (teddy_supported(TeddyPath::Avx2))
+      path = patterns_count > FAT_PATTERNS ? TeddyPath::FatAvx2
+                                           : TeddyPath::Avx2;
+  } else if (!teddy_supported(path)) {
+    throw std::runtime_error{
+        path == TeddyPath::Ssse3
+            ? "teddy: this processor does not have SSSE3"
+            : "teddy: this processor does not have AVX2"};
+  }
+  int buckets = path == TeddyPath::FatAvx2 ? FAT_BUCKETS : BUCKETS;
+
+  int fingerprint = MAX_FINGERPRINT;
+  for (auto const &pattern : patterns_data) {
+    if (pattern.empty())
+      throw std::runtime_error{"teddy: patterns cannot be empty"};
+    fingerprint = std::min(fingerprint, int(pattern.length()));
+  }
+  int lanes = (fingerprint + 1) / 2;
+
+  TeddyPatterns pat_data{patterns_count, path, buckets, fingerprint, lanes,
+                         {},             {},   {},      {},          {},
+                         {}};
+  for (auto const &pattern : patterns_data) {
+    pat_data.starts.push_back(pat_data.text.size());
+    pat_data.text.append(pattern);
+    pat_data.lengths.push_back(pattern.length());
+  }
+
+  std::vector<int> sorted(patterns_count);
+  std::iota(sorted.begin(), sorted.end(), 0);
+  std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+    return patterns_data[a] < patterns_data[b];
+  });
+
+  pat_data.bucket_offsets.assign(buckets + 1, 0);
+  for (int rank = 0; rank < patterns_count; rank++) {
+    int bucket = std::int64_t{rank} * buckets / patterns_count;
+    std::string_view pattern = patterns_data[sorted[rank]];
+    pat_data.bucket_patterns.push_back(sorted[rank]);
+    pat_data.bucket_offsets[bucket + 1]++;
+
+    int half = bucket / BUCKETS * 16;
+    int bit = 1 << bucket % BUCKETS;
+    for (int lane = 0; lane < lanes; lane++) {
+      int first = half + base_code(pattern[2 * lane]) * 4;
+      if (2 * lane + 1 < fingerprint) {
+        int second = base_code(pattern[2 * lane + 1]);
+        pat_data.masks[lane][first + second] |= bit;
+      } else {
+        for (int second = 0; second < 4; second++)
+          pat_data.masks[lane][first + second] |= bit;
+      }
+    }
+  }
+  std::partial_sum(pat_data.bucket_offsets.begin(),
+                   pat_data.bucket_offsets.end(),
+                   pat_data.bucket_offsets.begin());
+
+  return pat_data;
+}
+
+/*
+  Compare the patterns of the buckets in `buckets` with the sequence at
+  `position`, and report those that match.
+*/
+template <typename Report>
+inline void verify(TeddyPatterns const &pat_data, std::string_view sequence,
+                   std::size_t position, unsigned buckets, Report &report) {
+  std::size_t remaining = sequence.length() - position;
+
+  for (; buckets != 0; buckets &= buckets - 1) {
+    int bucket = __builtin_ctz(buckets);
+    for (int k = pat_data.bucket_offsets[bucket];
+         k < pat_data.bucket_offsets[bucket + 1]; k++) {
+      int pattern = pat_data.bucket_patterns[k];
+      std::size_t length = pat_data.lengths[pattern];
+      if (length <= remaining &&
+          std::memcmp(sequence.data() + position,
+                      pat_data.text.data() + pat_data.starts[pattern],
+                      length) == 0)
+        report(pattern, position);
+    }
+  }
+}
+
+/*
+  The scalar form of the filter, one position at a time, starting from
+  `position`. The SIMD forms finish off the end of the sequence with this.
+*/
+template <typename Report>
+void teddy_scalar(TeddyPatterns const &pat_data, std::string_view sequence,
+                  std::size_t position, Report &report) {
+  std::size_t n = sequence.length();
+  int fingerprint = pat_data.fingerprint;
+
+  for (; position + fingerprint <= n; position++) {
+    unsigned buckets = 0xffff;
+    for (int lane = 0; lane < pat_data.lanes && buckets != 0; lane++) {
+      int first = base_code(sequence[position + 2 * lane]) * 4;
+      int second = 2 * lane + 1 < fingerprint
+                       ? base_code(sequence[position + 2 * lane + 1])
+                       : 0;
+      auto const &mask = pat_data.masks[lane];
+      buckets &= mask[first + second] | mask[16 + first + second] << 8;
+    }
+    if (buckets != 0)
+      verify(pat_data, sequence, position, buckets, report);
+  }
+}
+
+#ifdef TEDDY_X86
+/*
+  The SSSE3 form, 16 positions at a time. Each pair of bases is read by two
+  unaligned loads, one character apart, which are turned into codes and then
+  into the index of the pair by shuffles. The last pair is always read whole,
+  even when only its first base counts, so the loop stops where that would
+  run off the end of the sequence.
+*/
+template <typename Report>
+__attribute__((target("ssse3"))) void
+teddy_ssse3(TeddyPatterns const &pat_data, std::string_view sequence,
+            Report &report) {
+  std::size_t n = sequence.length();
+  char const *data = sequence.data();
+  int lanes = pat_data.lanes;
+
+  __m128i const codes = _mm_load_si128((__m128i const *)NIBBLE_CODES);
+  __m128i const low_nibble = _mm_set1_epi8(0x0f);
+  __m128i masks[MAX_LANES];
+  for (int lane = 0; lane < lanes; lane++)
+    masks[lane] =
+        _mm_loadu_si128((__m128i const *)pat_data.masks[lane].data());
+
+  std::size_t position = 0;
+  for (; position + 16 + 2 * lanes - 1 <= n; position += 16) {
+    __m128i buckets = _mm_set1_epi8(-1);
+    for (int lane = 0; lane < lanes; lane++) {
+      char const *pair = data + position + 2 * lane;
+      __m128i first = _mm_loadu_si128((__m128i const *)pair);
+      __m128i second = _mm_loadu_si128((__m128i const *)(pair + 1));
+      first = _mm_shuffle_epi8(codes, _mm_and_si128(first, low_nibble));
+      second = _mm_shuffle_epi8(codes, _mm_and_si128(second, low_nibble));
+      __m128i index = _mm_or_si128(_mm_slli_epi16(first, 2), second);
+      buckets = _mm_and_si128(buckets, _mm_shuffle_epi8(masks[lane], index));
+    }
+
+    unsigned found =
+        ~_mm_movemask_epi8(_mm_cmpeq_epi8(buckets, _mm_setzero_si128())) &
+        0xffff;
+    if (found == 0)
+      continue;
+    alignas(16) std::uint8_t lane_buckets[16];
+    _mm_store_si128((__m128i *)lane_buckets, buckets);
+    for (; found != 0; found &= found - 1) {
+      int offset = __builtin_ctz(found);
+      verify(pat_data, sequence, position + offset, lane_buckets[offset],
+             report);
+    }
+  }
+
+  teddy_scalar(pat_data, sequence, position, report);
+}
+
+/*
+  The AVX2 form, the same as the SSSE3 one over 32 positions at a time. The
+  shuffles work within each 128-bit half, so the tables are in both halves.
+*/
+template <typename Report>
+__attribute__((target("avx2"))) void
+teddy_avx2(TeddyPatterns const &pat_data, std::string_view sequence,
+           Report &report) {
+  std::size_t n = sequence.length();
+  char const *data = sequence.data();
+  int lanes = pat_data.lanes;
+
+  __m256i const codes = _mm256_broadcastsi128_si256(
+      _mm_load_si128((__m128i const *)NIBBLE_CODES));
+  __m256i const low_nibble = _mm256_set1_epi8(0x0f);
+  __m256i masks[MAX_LANES];
+  for (int lane = 0; lane < lanes; lane++)
+    masks[lane] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i const *)pat_data.masks[lane].data()));
+
+  std::size_t position = 0;
+  for (; position + 32 + 2 * lanes - 1 <= n; position += 32) {
+    __m256i buckets = _mm256_set1_epi8(-1);
+    for (int lane = 0; lane < lanes; lane++) {
+      char const *pair = data + position + 2 * lane;
+      __m256i first = _mm256_loadu_si256((__m256i const *)pair);
+      __m256i second = _mm256_loadu_si256((__m256i const *)(pair + 1));
+      first = _mm256_shuffle_epi8(codes, _mm256_and_si256(first, low_nibble));
+      second =
+          _mm256_shuffle_epi8(codes, _mm256_and_si256(second, low_nibble));
+      __m256i index = _mm256_or_si256(_mm256_slli_epi16(first, 2), second);
+      buckets =
+          _mm256_and_si256(buckets, _mm256_shuffle_epi8(masks[lane], index));
+    }
+
+    unsigned found = ~unsigned(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(buckets, _mm256_setzero_si256())));
+    if (found == 0)
+      continue;
+    alignas(32) std::uint8_t lane_buckets[32];
+    _mm256_store_si256((__m256i *)lane_buckets, buckets);
+    for (; found != 0; found &= found - 1) {
+      int offset = __builtin_ctz(found);
+      verify(pat_data, sequence, position + offset, lane_buckets[offset],
+             report);
+    }
+  }
+
+  teddy_scalar(pat_data, sequence, position, report);
+}
+
+/*
+  The fat AVX2 form. The same 16 characters are in both halves of each
+  register, and each half is shuffled with the masks for its own eight
+  buckets.
+*/
+template <typename Report>
+__attribute__((target("avx2"))) void
+teddy_fat_avx2(TeddyPatterns const &pat_data, std::string_view sequence,
+               Report &report) {
+  std::size_t n = sequence.length();
+  char const *data = sequence.data();
+  int lanes = pat_data.lanes;
+
+  __m256i const codes = _mm256_broadcastsi128_si256(
+      _mm_load_si128((__m128i const *)NIBBLE_CODES));
+  __m256i const low_nibble = _mm256_set1_epi8(0x0f);
+  __m256i masks[MAX_LANES];
+  for (int lane = 0; lane < lanes; lane++)
+    masks[lane] =
+        _mm256_loadu_si256((__m256i const *)pat_data.masks[lane].data());
+
+  std::size_t position = 0;
+  for (; position + 16 + 2 * lanes - 1 <= n; position += 16) {
+    __m256i buckets = _mm256_set1_epi8(-1);
+    for (int lane = 0; lane < lanes; lane++) {
+      char const *pair = data + position + 2 * lane;
+      __m256i first = _mm256_broadcastsi128_si256(
+          _mm_loadu_si128((__m128i const *)pair));
+      __m256i second = _mm256_broadcastsi128_si256(
+          _mm_loadu_si128((__m128i const *)(pair + 1)));
+      first = _mm256_shuffle_epi8(codes, _mm256_and_si256(first, low_nibble));
+      second =
+          _mm256_shuffle_epi8(codes, _mm256_and_si256(second, low_nibble));
+      __m256i index = _mm256_or_si256(_mm256_slli_epi16(first, 2), second);
+      buckets =
+          _mm256_and_si256(buckets, _mm256_shuffle_epi8(masks[lane], index));
+    }
+
+    unsigned found = ~unsigned(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(buckets, _mm256_setzero_si256())));
+    found = (found | found >> 16) & 0xffff;
+    if (found == 0)
+      continue;
+    alignas(32) std::uint8_t lane_buckets[32];
+    _mm256_store_si256((__m256i *)lane_buckets, buckets);
+    for (; found != 0; found &= found - 1) {
+      int offset = __builtin_ctz(found);
+      verify(pat_data, sequence, position + offset,
+             lane_buckets[offset] | lane_buckets[16 + offset] << 8, report);
+    }
+  }
+
+  teddy_scalar(pat_data, sequence, position, report);
+}
+#endif // TEDDY_X86
+
+/*
+  Search the sequence with the form of the filter chosen by init_teddy().
+  `report` is called with the index of the pattern and the offset of each
+  match, in order of offset but not of pattern.
+*/
+template <typename Report>
+void teddy(TeddyPatterns const &pat_data, std::string_view sequence,
+           Report report) {
+  switch (pat_data.path) {
+#ifdef TEDDY_X86
+  case TeddyPath::FatAvx2:
+    teddy_fat_avx2(pat_data, sequence, report);
+    return;
+  case TeddyPath::Avx2:
+    teddy_avx2(pat_data, sequence, report);
+    return;
+  case TeddyPath::Ssse3:
+    teddy_ssse3(pat_data, sequence, report);
+    return;
+#endif
+  default:
+    teddy_scalar(pat_data, sequence, 0, report);
+    return;
+  }
+}
+
+/*
+  The count-only form of the above, as aho_corasick() has.
+*/
+std::vector<int> teddy(TeddyPatterns const &pat_data,
+                       std::string_view sequence) {
+  std::vector<int> matches(pat_data.pattern_count, 0);
+  teddy(pat_data, sequence,
+        [&](int pattern, std::size_t) { matches[pattern]++; });
+
+  return matches;
+}
+
+/*
+  The engine, for each form of the search. The forms other than Auto are
+  there to check them against each other; asking for one the processor does
+  not have is an error.
+*/
+template <TeddyPath PATH> struct Teddy {
+  typedef TeddyPatterns Compiled;
+  static Compiled init(std::vector<std::string_view> const &patterns) {
+    return init_teddy(patterns, PATH);
+  }
+  static std::vector<int> search(Compiled const &pat_data,
+                                 std::string_view sequence) {
+    return teddy(pat_data, sequence);
+  }
+  template <typename Report>
+  static void search(Compiled const &pat_data, std::string_view sequence,
+                     Report report) {
+    teddy(pat_data, sequence, report);
+  }
+};
+
+// Make the engines available to the combined binary as well.
+static RegisterEngine<Teddy<TeddyPath::Auto>> registration{"teddy"};
+static RegisterEngine<Teddy<TeddyPath::Scalar>> scalar_registration{
+    "teddy_scalar"};
+static RegisterEngine<Teddy<TeddyPath::Ssse3>> ssse3_registration{
+    "teddy_ssse3"};
+static RegisterEngine<Teddy<TeddyPath::Avx2>> avx2_registration{"teddy_avx2"};
+static RegisterEngine<Teddy<TeddyPath::FatAvx2>> fat_avx2_registration{
+    "teddy_fat_avx2"};
+
+#ifndef MULTI_ENGINE
+/*
+  All that is done here is call the run_multi() function with the algorithm's
+  engine, the label for the algorithm, and the argc/argv values.
+*/
+int main(int argc, char *argv[]) {
+  int return_code = run_multi<Teddy<TeddyPath::Auto>>("teddy", argc, argv);
+
+  return return_code;
+}
+#endif // !MULTI_ENGINE
@@ -0,0 +1,133 @@
+/*
+  The update benchmark for the incremental Aho-Corasick machine. This times
+  changes to a dictionary against building it again from scratch.
+
+  The machine is built from all but the last -u patterns. Then, -u times
+  over, one of those held back is added and one of the first patterns is
+  removed, so that the dictionary stays the same size; by the end it holds
+  the same patterns as the file less the first -u. A machine built from
+  scratch for those is timed, and both machines are run over the sequences
+  to check that they find the same matches.
+
+  The cost of each change is given both as a time and as the number of
+  states whose links were looked at, next to the number that a full build
+  looks at (every state).
+*/
+
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "incremental.hpp"
+#include "run.hpp"
+
+// The number of patterns added and removed, unless -u says otherwise.
+constexpr int DEFAULT_UPDATES = 100;
+
+int main(int argc, char *argv[]) {
+  int updates = DEFAULT_UPDATES;
+  int opt;
+  bool ok = true;
+
+  while ((opt = getopt(argc, argv, "u:")) != -1) {
+    switch (opt) {
+    case 'u':
+      updates = std::stoi(optarg);
+      if (updates < 1)
+        ok = false;
+      break;
+    default:
+      ok = false;
+      break;
+    }
+  }
+  if (!ok || argc - optind != 2) {
+    std::ostringstream error;
+    error << "Usage: " << argv[0] << " [ -u <updates> ] <sequences> <patterns>";
+    throw std::runtime_error{error.str()};
+  }
+
+  Experiment data =
+      load_experiment(argv[optind], argv[optind + 1], nullptr, -1);
+  std::vector<std::string_view> patterns{data.patterns.begin(),
+                                         data.patterns.end()};
+  int count = patterns.size();
+  if (2 * updates > count) {
+    std::ostringstream error;
+    error << "Cannot make " << updates << " updates to " << count
+          << " patterns: at most half of them can be changed";
+    throw std::runtime_error{error.str()};
+  }
+
+  // The starting dictionary.
+  double start_time = get_time();
+  IncrementalAhoCorasick machine{std::vector<std::string_view>{
+      patterns.begin(), patterns.end() - updates}};
+  double build_time = get_time() - start_time;
+
+  // The changes.
+  std::vector<double> add_times, remove_times, add_costs, remove_costs;
+  for (int idx = 0; idx < updates; idx++) {
+    start_time = get_time();
+    machine.add(patterns[count - updates + idx]);
+    add_times.push_back(get_time() - start_time);
+    add_costs.push_back(machine.last_cost());
+
+    start_time = get_time();
+    machine.remove(idx);
+    remove_times.push_back(get_time() - start_time);
+    remove_costs.push_back(machine.last_cost());
+  }
+
+  // Building the final dictionary from scratch. Its patterns are in the same
+  // order as the live patterns of the changed machine, whose numbers are
+  // `updates` higher.
+  start_time = get_time();
+  IncrementalAhoCorasick rebuilt{std::vector<std::string_view>{
+      patterns.begin() + updates, patterns.end()}};
+  double rebuild_time = get_time() - start_time;
+
+  std::size_t mismatches = 0;
+  for (auto const &sequence : data.sequences) {
+    std::vector<int> changed = machine.search(sequence);
+    std::vector<int> expected = rebuilt.search(sequence);
+    for (int idx = 0; idx < updates; idx++)
+      if (changed[idx] != 0)
+        mismatches++;
+    for (int idx = updates; idx < count; idx++)
+      if (changed[idx] != expected[idx - updates])
+        mismatches++;
+  }
+  // A machine that finds the right matches but has more states than the
+  // rebuilt one has leaked some, and that is a failure too.
+  bool size_mismatch = machine.size() != rebuilt.size();
+  if (size_mismatch)
+    std::cerr << "The changed machine has " << machine.size()
+              << " states, and the rebuilt one " << rebuilt.size() << "\n";
+
+  Summary add_time = summarize(add_times);
+  Summary remove_time = summarize(remove_times);
+  std::cout << std::setprecision(8)
+            << "algorithm: aho_corasick_incremental\n"
+            << "patterns: " << count - updates << "\n"
+            << "states: " << rebuilt.size() << "\n"
+            << "updates: " << updates << "\n"
+            << "build_time: " << build_time << "\n"
+            << "rebuild_time: " << rebuild_time << "\n"
+            << "rebuild_cost: " << rebuilt.last_cost() << "\n"
+            << "add_time: " << add_time << "\n"
+            << "add_cost: " << summarize(add_costs) << "\n"
+            << "remove_time: " << remove_time << "\n"
+            << "remove_cost: " << summarize(remove_costs) << "\n"
+            << "add_speedup: " << rebuild_time / add_time.median << "\n"
+            << "remove_speedup: " << rebuild_time / remove_time.median << "\n"
+            << "mismatches: " << mismatches << "\n"
+            << "size_mismatch: " << (size_mismatch ? "true" : "false") << "\n";
+
+  return mismatches != 0 || size_mismatch;
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+
+# Convert a sequences (or patterns) data file from the text format written by
+# random_data.py into the compact 2-bit packed binary format. The C++ code can
+# load either format; see read_packed_sequences() in C++/input.cpp.
+#
+# This is an on-disk format only. The runners decode a packed file back to one
+# byte per base when they load it, as no engine searches the 2-bit form, so it
+# makes files smaller and quicker to read but does not reduce memory use.
+#
+# Layout of the packed file (all integers are little-endian):
+#
+#   offset 0   4 bytes    magic, the characters "DNA2"
+#   offset 4   uint32     format version (currently 1)
+#   offset 8   uint64     number of records, N
+#   offset 16  uint64     maximum record length, in bases
+#   offset 24  uint64[N]  record index: byte offset of each record's packed
+#                         bases, relative to the start of the base data
+#   ...        uint32[N]  length table: number of bases in each record
+#   ...        padding    zero bytes up to the next multiple of 8
+#   ...        bytes      the packed bases
+#
+# Each base takes 2 bits (A=0, C=1, G=2, T=3), four to a byte, with the first
+# base of a byte in its two lowest bits. Every record starts on an 8-byte
+# boundary so that code searching the packed text can read it a 64-bit word at
+# a time without straddling into the previous record.
+
+import argparse
+import struct
+from sys import stdout
+
+
+MAGIC = b"DNA2"
+VERSION = 1
+ALIGN = 8
+CODES = {"A": 0, "C": 1, "G": 2, "T": 3}
+
+
+def parse_command_line():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        "input",
+        type=str,
+        help="Name of the text-format file to read",
+    )
+    parser.add_argument(
+        "output",
+        type=str,
+        help="Name of the packed file to write",
+    )
+
+    return vars(parser.parse_args())
+
+
+def read_records(file):
+    with open(file, "r") as f:
+        count = int(f.readline().split()[0])
+        records = [line.rstrip("\n") for line in f]
+
+    if len(records) != count:
+        raise ValueError(f"{file}: wrong number of lines read")
+
+    return records
+
+
+def pack_record(record):
+    packed = bytearray((len(record) + 3) // 4)
+    for idx, char in enumerate(record):
+        if char not in CODES:
+            raise ValueError(f"Character {char!r} cannot be packed")
+        packed[idx // 4] |= CODES[char] << (2 * (idx % 4))
+
+    # Pad the record out to the alignment boundary:
+    packed.extend(bytes(-len(packed) % ALIGN))
+    return packed
+
+
+def write_packed(records, output):
+    count = len(records)
+    max_length = max(map(len, records), default=0)
+
+    offsets = []
+    data = bytearray()
+    for record in records:
+        offsets.append(len(data))
+        data.extend(pack_record(record))
+
+    header = struct.pack("<4sIQQ", MAGIC, VERSION, count, max_length)
+    header += struct.pack(f"<{count}Q", *offsets)
+    header += struct.pack(f"<{count}I", *map(len, records))
+    header += bytes(-len(header) % ALIGN)
+
+    with open(output, "wb") as f:
+        f.write(header)
+        f.write(data)
+
+    return len(header) + len(data)
+
+
+def main():
+    args = parse_command_line()
+
+    print(f"Reading {args['input']}...", end="")
+    stdout.flush()
+    records = read_records(args["input"])
+    print(f" {len(records)} records.")
+
+    print(f"Writing {args['output']}...", end="")
+    stdout.flush()
+    size = write_packed(records, args["output"])
+    print(f" {size} bytes.")
+
+
+if __name__ == "__main__":
+    main()